@@ -2,6 +2,9 @@ F_CPU := 16000000ULL
 
 BOOTLOADER_SECTION_START_ADDRESS=0x7000
 
+# Bootloader has to fit between section start and the end of flash
+MCU_FLASH_SIZE := 32768
+
 CFLAGS += -mmcu=$(MCU) -DF_CPU=$(F_CPU) -DBOOTLOADER_SECTION_START_ADDRESS=$(BOOTLOADER_SECTION_START_ADDRESS)
 
 # -fomit-frame-pointer        When possible do not generate stack frames
@@ -8,5 +8,8 @@ _U8 crc8_getForByte(_U8 byte, _U8 polynomial, _U8 start);
 
 _U8 crc8_get(_U8 *buffer, _U16 bufferSize, _U8 polynomial, _U8 start);
 
+// Table driven step of image checksum (IMAGE_CHECKSUM_POLYNOMIAL only)
+_U8 crc8_update(_U8 remainder, _U8 byte);
+
 
 #endif /* BOOTLOADER_COMMON_CRC8_H_ */
@@ -4,6 +4,64 @@
 
 #define IMAGE_CHECKSUM_POLYNOMIAL 0xD9 // (CRC-8-WCDMA)
 
+/*
+ * Image header written by commit at the end of application area (offsets
+ * are counted back from its end):
+ *  5: magic
+ *  4: used image length, LSB
+ *  3: used image length, MSB
+ *  2: checksum of used image followed by magic and length bytes
+ *  1: checksum of whole application area (older bootloaders check only this)
+ */
+#define IMAGE_HEADER_SIZE            5
+#define IMAGE_HEADER_MAGIC           0xa5
+#define IMAGE_HEADER_OFFSET_MAGIC    5
+#define IMAGE_HEADER_OFFSET_LENGTH   4
+#define IMAGE_HEADER_OFFSET_CHECKSUM 2
+
+#define PAGE_CHECKSUM_POLYNOMIAL 0x8408 // (CRC-16-CCITT, reversed)
+#define PAGE_CHECKSUM_INITIAL    0xffff
+
+// FLASH_WRITE_PAGES wValue flags
+#define BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE   0x01
+#define BOOTLOADER_COMMON_FLASH_WRITE_FLAG_COMPARE 0x02 // Pages already holding the data are not programmed
+
+/*
+ * Commands supported by bootloader, reported by HELLO. Bootloaders older than
+ * 0.11 do not know HELLO, their capabilities are derived from version.
+ */
+#define BOOTLOADER_COMMON_CAPABILITY_E2PROM_BLOCK      0x0001 // E2PROM_READ_BLOCK, E2PROM_WRITE_BLOCK
+#define BOOTLOADER_COMMON_CAPABILITY_FLASH_CRC         0x0002 // FLASH_CRC
+#define BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_WRITE 0x0004 // FLASH_ERASE_WRITE_PAGE
+#define BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES_CRC   0x0008 // FLASH_PAGES_CRC
+#define BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES       0x0010 // FLASH_READ_PAGES, FLASH_WRITE_PAGES
+#define BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_PAGES 0x0020 // FLASH_ERASE_PAGES
+#define BOOTLOADER_COMMON_CAPABILITY_E2PROM_QUEUE      0x0040 // E2PROM_SYNC, e2prom writes are queued
+#define BOOTLOADER_COMMON_CAPABILITY_FLASH_COMPARE     0x0080 // FLASH_WRITE_FLAG_COMPARE, FLASH_REPORT, blank pages are not erased
+#define BOOTLOADER_COMMON_CAPABILITY_STATS             0x0100 // GET_STATS
+
+// E2PROM_SYNC wValue flags
+#define BOOTLOADER_COMMON_E2PROM_SYNC_FLAG_WAIT 0x01
+
+// Status, then 16 bit counters (LSB first): pages written, pages unchanged, pages erased, erases skipped on blank pages
+#define BOOTLOADER_COMMON_FLASH_REPORT_RESPONSE_SIZE 9
+
+// GET_STATS wValue flags
+#define BOOTLOADER_COMMON_STATS_FLAG_CLEAR 0x01 // Counters are cleared after reply, watchdog resets and boot check time are kept
+
+/*
+ * Status, then counters (LSB first):
+ *  32 bit: SETUP requests, bytes received, bytes sent
+ *  16 bit: pages erased, pages written
+ *  32 bit: SPM busy timer ticks, timer frequency in Hz
+ *  16 bit: watchdog resets not requested by REBOOT
+ *  16 bit: timer ticks spent by image check at boot
+ */
+#define BOOTLOADER_COMMON_STATS_RESPONSE_SIZE 29
+
+// Status, version major and minor, boot size in pages, 3 signature bytes, capabilities (LSB first)
+#define BOOTLOADER_COMMON_HELLO_RESPONSE_SIZE 9
+
 
 typedef enum _BootloaderCommonCommand {
 	BOOTLOADER_COMMON_COMMAND_CONNECT = 0xa0,
@@ -13,7 +71,29 @@ typedef enum _BootloaderCommonCommand {
 	BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE,
 	BOOTLOADER_COMMON_COMMAND_E2PROM_READ,
 	BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE,
-	BOOTLOADER_COMMON_COMMAND_REBOOT
+	BOOTLOADER_COMMON_COMMAND_REBOOT,
+	BOOTLOADER_COMMON_COMMAND_E2PROM_READ_BLOCK,
+	BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK,
+	// wIndex: first page, wValue: pages count (LSB), initial CRC remainder (MSB)
+	BOOTLOADER_COMMON_COMMAND_FLASH_CRC,
+	// Erases page before programming received data
+	BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE,
+	// wIndex: first page, wLength: pages count * 2. Returns CRC-16 (LSB first) of each page
+	BOOTLOADER_COMMON_COMMAND_FLASH_PAGES_CRC,
+	// wIndex: first page, wLength: pages count * page size
+	BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGES,
+	// wIndex: first page, wValue: write flags, wLength: pages count * page size
+	BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES,
+	// wIndex: first page, wValue: pages count. Replies once all pages are erased
+	BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGES,
+	// Connects and returns GET_INFO response followed by capabilities in one reply
+	BOOTLOADER_COMMON_COMMAND_HELLO,
+	// wValue: sync flags. Returns status and count of queued e2prom bytes not yet written (LSB first)
+	BOOTLOADER_COMMON_COMMAND_E2PROM_SYNC,
+	// Returns flash work done since previous report or connection and clears it
+	BOOTLOADER_COMMON_COMMAND_FLASH_REPORT,
+	// wValue: stats flags. Returns device counters since boot or previous clear
+	BOOTLOADER_COMMON_COMMAND_GET_STATS
 } BootloaderCommonCommand;
 
 typedef enum _BootloaderCommonCommandStatus {
@@ -1,5 +1,8 @@
 
+#include <avr/pgmspace.h>
+
 #include "bootloader/common/crc8.h"
+#include "bootloader/common/crc8_table.h"
 
 /*
  * polynomials: reversed
@@ -45,3 +48,12 @@ _U8 crc8_get(_U8 *buffer, _U16 bufferSize, _U8 polynomial, _U8 start) {
 
     return remainder;
 }
+
+
+// Table for IMAGE_CHECKSUM_POLYNOMIAL, 256 bytes of flash for ~6x faster boot check
+static const _U8 crc8Table[256] PROGMEM = CRC8_TABLE_INITIALIZER;
+
+
+_U8 crc8_update(_U8 remainder, _U8 byte) {
+	return pgm_read_byte(&crc8Table[remainder ^ byte]);
+}
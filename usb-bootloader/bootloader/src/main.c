@@ -3,8 +3,10 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <avr/boot.h>
+#include <util/crc16.h>
 
 #include <avr/pgmspace.h>
+#include <string.h>
 #include "usbdrv.h"
 
 #include "bootloader/common/types.h"
@@ -17,7 +19,19 @@
 //#define DEBUG_LED
 
 #define BOOTLOADER_VERSION_MAJOR 0x00
-#define BOOTLOADER_VERSION_MINOR 0x04
+#define BOOTLOADER_VERSION_MINOR 0x0f
+
+#define BOOTLOADER_CAPABILITIES ( \
+	BOOTLOADER_COMMON_CAPABILITY_E2PROM_BLOCK | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_CRC | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_WRITE | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES_CRC | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_PAGES | \
+	BOOTLOADER_COMMON_CAPABILITY_E2PROM_QUEUE | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_COMPARE | \
+	BOOTLOADER_COMMON_CAPABILITY_STATS \
+)
 
 #define BOOTLOADER_SIZE_IN_PAGES           (((_U16) FLASHEND + 1 - BOOTLOADER_SECTION_START_ADDRESS) / SPM_PAGESIZE)
 
@@ -25,6 +39,21 @@
 
 #define BOOTLOADER_BYTE_APP_CRC8           (FLASHEND - BOOTLOADER_SIZE_IN_PAGES * SPM_PAGESIZE)
 
+#define BOOTLOADER_BYTE_IMAGE_HEADER       (BOOTLOADER_BYTE_APP_CRC8 + 1 - IMAGE_HEADER_SIZE)
+
+// Must be power of two
+#define BOOTLOADER_E2PROM_QUEUE_SIZE 64
+
+// Free queue entries needed to accept next USB data packet
+#define BOOTLOADER_E2PROM_QUEUE_RESERVE 8
+
+// Timer1 clock divider used to measure SPM busy time
+#define BOOTLOADER_SPM_TIMER_PRESCALER 64
+#define BOOTLOADER_SPM_TIMER_FREQUENCY ((_U32) F_CPU / BOOTLOADER_SPM_TIMER_PRESCALER)
+
+// Written before REBOOT command resets MCU by watchdog
+#define BOOTLOADER_REBOOT_MARKER 0x5a
+
 #define BOOTLOADER_ACTIVATION_PIO_BANK B
 #define BOOTLOADER_ACTIVATION_PIO_PIN  0
 
@@ -39,16 +68,86 @@ typedef enum _BootloaderState {
 	BOOTLOADER_STATE_IDLE,
 	BOOTLOADER_STATE_PAGE_READ,
 	BOOTLOADER_STATE_PAGE_WRITE,
+	BOOTLOADER_STATE_PAGE_ERASE_WRITE,
+	BOOTLOADER_STATE_PAGES_CRC,
+	BOOTLOADER_STATE_E2PROM_READ,
+	BOOTLOADER_STATE_E2PROM_WRITE,
 	BOOTLOADER_STATE_RESET,
 } BootloaderState;
 
 
-static _U8 responseBuffer[8] = { 0 };
+typedef struct _E2promQueueEntry {
+	_U16 address;
+	_U8  value;
+} E2promQueueEntry;
+
+
+typedef struct _FlashReport {
+	_U16 pagesWritten;
+	_U16 pagesUnchanged;
+	_U16 pagesErased;
+	_U16 erasesSkipped;
+} FlashReport;
+
+
+// Sent by GET_STATS after status byte, AVR structures are packed and little endian
+typedef struct _BootloaderStats {
+	_U32 setupRequests;
+	_U32 bytesIn;
+	_U32 bytesOut;
+	_U16 pagesErased;
+	_U16 pagesWritten;
+	_U32 spmTicks;
+} BootloaderStats;
+
+
+typedef enum _FlashStage {
+	FLASH_STAGE_IDLE,
+	FLASH_STAGE_ERASE, // Page erase in progress, temporary buffer is filled
+	FLASH_STAGE_WRITE  // Page write in progress
+} FlashStage;
+
+
+// Sized for the longest response
+static _U8 responseBuffer[BOOTLOADER_COMMON_STATS_RESPONSE_SIZE] = { 0 };
 
 static volatile BootloaderState bootloaderState = BOOTLOADER_STATE_IDLE;
 static volatile _U16            currentAddress  = 0;
 static volatile _U16            dataSize        = 0;
 
+static U16union pageChecksum;
+
+// Next page is received here while the previous one is programmed
+static U16union   pageStaging[SPM_PAGESIZE / 2];
+static _U16       stagingAddress;
+static _U8        stagingFlags; // BOOTLOADER_COMMON_FLASH_WRITE_FLAG_*
+static _BOOL      stagingFull  = FALSE;
+
+static FlashStage flashStage   = FLASH_STAGE_IDLE;
+static _U16       flashAddress = 0;
+
+// FLASH_WRITE_FLAG_* of current write request
+static _U8        flashWriteFlags;
+
+static FlashReport flashReport;
+
+static BootloaderStats stats;
+static _U16            spmStartTick;
+
+// Timer ticks from start until application image was checked
+static _U16            bootCheckTicks;
+
+// Not initialized by startup code to survive watchdog reset, application may overwrite them
+static _U8  resetFlags          __attribute__ ((section(".noinit")));
+static _U8  rebootMarker        __attribute__ ((section(".noinit")));
+static _U16 watchdogResets      __attribute__ ((section(".noinit")));
+static _U16 watchdogResetsCheck __attribute__ ((section(".noinit")));
+
+// E2prom bytes acknowledged to host and written from main loop
+static E2promQueueEntry e2promQueue[BOOTLOADER_E2PROM_QUEUE_SIZE];
+static _U8              e2promQueueHead  = 0;
+static _U8              e2promQueueCount = 0;
+
 void __reset(void) {
 	__asm__ __volatile__ ("rjmp __init2 \n\t"::);
 }
@@ -78,6 +177,8 @@ static void __init3(void) {
 		// WDE is overridden by WDRF in MCUSR. This means that WDE is always set when WDRF is
 		// set. To clear WDE, WDRF must be cleared first. This feature ensures multiple resets during conditions
 		// causing failure, and a safe start-up after the failure.
+		resetFlags = MCUSR;
+
 		CLEAR_BIT_AT(MCUSR, WDRF);
 
 		wdt_disable();
@@ -106,18 +207,236 @@ static _U8 _e2promRead(_U16 address) {
 }
 
 
-static void _e2promWrite(_U16 address, _U8 value) {
+// Starts write without waiting for its end, EEPE has to be cleared
+static void _e2promWriteStart(_U16 address, _U8 value) {
 	EEAR = address;
 	EEDR = value;
 
+	// EEPE has to be set within four cycles after EEMPE
+	cli();
+
 	// Write logical one to EEMPE
 	SET_BIT_AT(EECR, EEMPE);
 
 	// Start eeprom write by setting EEPE
 	SET_BIT_AT(EECR, EEPE);
 
-	// Wait until eprom is writing
-	while (CHECK_BIT_AT(EECR, EEPE));
+	sei();
+}
+
+
+// Starts write of the next queued byte if e2prom is ready, called from main loop
+static void _e2promQueuePoll(void) {
+	if ((e2promQueueCount == 0) || CHECK_BIT_AT(EECR, EEPE)) {
+		return;
+	}
+
+	_e2promWriteStart(e2promQueue[e2promQueueHead].address, e2promQueue[e2promQueueHead].value);
+
+	e2promQueueHead   = (e2promQueueHead + 1) & (BOOTLOADER_E2PROM_QUEUE_SIZE - 1);
+	e2promQueueCount -= 1;
+
+	// Data NAKed since queue was full is accepted again
+	if (usbAllRequestsAreDisabled() && (e2promQueueCount <= BOOTLOADER_E2PROM_QUEUE_SIZE - BOOTLOADER_E2PROM_QUEUE_RESERVE)) {
+		usbEnableAllRequests();
+	}
+}
+
+
+static void _e2promQueuePush(_U16 address, _U8 value) {
+	E2promQueueEntry *entry;
+
+	while (e2promQueueCount == BOOTLOADER_E2PROM_QUEUE_SIZE) {
+		_e2promQueuePoll();
+	}
+
+	entry = &e2promQueue[(e2promQueueHead + e2promQueueCount) & (BOOTLOADER_E2PROM_QUEUE_SIZE - 1)];
+
+	entry->address = address;
+	entry->value   = value;
+
+	e2promQueueCount += 1;
+}
+
+
+// Writes all queued bytes, e2prom can not be read and SPM can not be used before
+static void _e2promQueueFlush(void) {
+	while ((e2promQueueCount > 0) || CHECK_BIT_AT(EECR, EEPE)) {
+		_e2promQueuePoll();
+	}
+}
+
+
+static void _spmTimerStart(void) {
+	spmStartTick = TCNT1;
+}
+
+
+// Single SPM operation takes few ms, 16 bit timer cannot overflow meanwhile
+static void _spmTimerStop(void) {
+	stats.spmTicks += (_U16) (TCNT1 - spmStartTick);
+}
+
+
+// RWW section has to be readable
+static _BOOL _flashPageIsBlank(_U16 address) {
+	_U8 i = 0;
+
+	do {
+		if (pgm_read_byte(address + i) != 0xff) {
+			return FALSE;
+		}
+
+		i += 1;
+	} while (i < SPM_PAGESIZE);
+
+	return TRUE;
+}
+
+
+// Blocking erase, pages which are already blank are left untouched
+static void _flashPageErase(_U16 address) {
+	if (_flashPageIsBlank(address)) {
+		flashReport.erasesSkipped++;
+
+		return;
+	}
+
+	_spmTimerStart();
+
+	cli();
+	boot_page_erase(address);
+	sei();
+
+	boot_spm_busy_wait();
+
+	boot_rww_enable();
+	boot_spm_busy_wait();
+
+	_spmTimerStop();
+
+	flashReport.pagesErased++;
+	stats.pagesErased++;
+}
+
+
+// Staged page equals flash content, RWW section has to be readable
+static _BOOL _flashPageIsUnchanged(void) {
+	_U8 *data = (_U8 *) pageStaging;
+	_U8  i    = 0;
+
+	do {
+		if (pgm_read_byte(stagingAddress + i) != data[i]) {
+			return FALSE;
+		}
+
+		i += 1;
+	} while (i < SPM_PAGESIZE);
+
+	return TRUE;
+}
+
+
+/*
+ * Advances page programming without waiting for SPM, called from main loop.
+ * Staged page is moved to temporary page buffer as soon as SPM is free, so
+ * USB can receive the next one meanwhile.
+ */
+static void _flashProgramPoll(void) {
+	if (boot_spm_busy()) {
+		return;
+	}
+
+	if (flashStage == FLASH_STAGE_ERASE) {
+		cli();
+		boot_page_write(flashAddress);
+		sei();
+
+		flashStage = FLASH_STAGE_WRITE;
+
+		return;
+	}
+
+	if (flashStage == FLASH_STAGE_WRITE) {
+		boot_rww_enable();
+		boot_spm_busy_wait();
+
+		_spmTimerStop();
+
+		flashStage = FLASH_STAGE_IDLE;
+	}
+
+	if (stagingFull) {
+		_BOOL erase = (stagingFlags & BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE);
+		_U8   i;
+
+		// No SPM is in progress and RWW section is enabled here, so flash can be read
+		if ((stagingFlags & BOOTLOADER_COMMON_FLASH_WRITE_FLAG_COMPARE) && _flashPageIsUnchanged()) {
+			stagingFull = FALSE;
+
+			if (usbAllRequestsAreDisabled()) {
+				usbEnableAllRequests();
+			}
+
+			flashReport.pagesUnchanged++;
+
+			return;
+		}
+
+		if (erase && _flashPageIsBlank(stagingAddress)) {
+			erase = FALSE;
+
+			flashReport.erasesSkipped++;
+		}
+
+		for (i = 0; i < SPM_PAGESIZE / 2; i++) {
+			cli();
+			boot_page_fill(stagingAddress + 2 * i, pageStaging[i].word);
+			sei();
+		}
+
+		flashAddress = stagingAddress;
+		stagingFull  = FALSE;
+
+		// Page data NAKed since staging buffer was full is accepted again
+		if (usbAllRequestsAreDisabled()) {
+			usbEnableAllRequests();
+		}
+
+		// Page erase keeps temporary page buffer content (datasheet:
+		// 'fill the buffer before a Page Erase' alternative)
+		flashReport.pagesWritten++;
+		stats.pagesWritten++;
+
+		// Measured until page write is finished
+		_spmTimerStart();
+
+		if (erase) {
+			cli();
+			boot_page_erase(flashAddress);
+			sei();
+
+			flashReport.pagesErased++;
+			stats.pagesErased++;
+
+			flashStage = FLASH_STAGE_ERASE;
+
+		} else {
+			cli();
+			boot_page_write(flashAddress);
+			sei();
+
+			flashStage = FLASH_STAGE_WRITE;
+		}
+	}
+}
+
+
+// Finishes programming of all received pages, RWW section and e2prom are not accessible before
+static void _flashProgramFlush(void) {
+	while (stagingFull || (flashStage != FLASH_STAGE_IDLE)) {
+		_flashProgramPoll();
+	}
 }
 
 
@@ -130,17 +449,92 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 
 		DBG(("SETUP"));
 
+		stats.setupRequests++;
+
 		if ((request->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_VENDOR){
 			DBG(("Vendor"));
 
+			// Only flash writes are streamed, every other command sees programmed flash
+			if (
+				request->bRequest != BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE &&
+				request->bRequest != BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE &&
+				request->bRequest != BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES
+			) {
+				_flashProgramFlush();
+			}
+
+			// Only e2prom writes and sync status query leave the queue running
+			if (
+				request->bRequest != BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE &&
+				request->bRequest != BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK &&
+				! (
+					request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_SYNC &&
+					! (request->wValue.bytes[0] & BOOTLOADER_COMMON_E2PROM_SYNC_FLAG_WAIT)
+				)
+			) {
+				_e2promQueueFlush();
+			}
+
 			if (
 				request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE ||
+				request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE ||
 				request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE ||
 				request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGE
 			) {
 				if (wIndex >= BOOTLOADER_APPLICATION_PAGES_COUNT) {
 					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
 
+					goto funcRet;
+				}
+
+			} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGES) {
+				if ((wIndex >= BOOTLOADER_APPLICATION_PAGES_COUNT) || (request->wValue.word > BOOTLOADER_APPLICATION_PAGES_COUNT - wIndex)) {
+					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+
+					goto funcRet;
+				}
+
+			} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_CRC) {
+				if ((wIndex >= BOOTLOADER_APPLICATION_PAGES_COUNT) || (request->wValue.bytes[0] > BOOTLOADER_APPLICATION_PAGES_COUNT - wIndex)) {
+					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+
+					goto funcRet;
+				}
+
+			} else if (
+				request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGES ||
+				request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES
+			) {
+				if (
+					(request->wLength.word % SPM_PAGESIZE != 0) ||
+					(wIndex >= BOOTLOADER_APPLICATION_PAGES_COUNT) ||
+					(request->wLength.word / SPM_PAGESIZE > BOOTLOADER_APPLICATION_PAGES_COUNT - wIndex)
+				) {
+					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+
+					goto funcRet;
+				}
+
+			} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_PAGES_CRC) {
+				if (
+					(request->wLength.word & 0x01) ||
+					(wIndex >= BOOTLOADER_APPLICATION_PAGES_COUNT) ||
+					(request->wLength.word / 2 > BOOTLOADER_APPLICATION_PAGES_COUNT - wIndex)
+				) {
+					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+
+					goto funcRet;
+				}
+			}
+
+			if (
+				request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_READ_BLOCK ||
+				request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK
+			) {
+				// Sum of 16 bit values could wrap around
+				if ((wIndex > (_U16) E2END) || (request->wLength.word > (_U16) E2END + 1 - wIndex)) {
+					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+
 					goto funcRet;
 				}
 			}
@@ -148,16 +542,55 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 			if ((request->bmRequestType & USBRQ_DIR_MASK) == USBRQ_DIR_HOST_TO_DEVICE) {
 				DBG(("Write"));
 
-				if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE) {
+				if (
+					request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE ||
+					request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE
+				) {
 					DBG(("WPAG"));
 
-					bootloaderState = BOOTLOADER_STATE_PAGE_WRITE;
+					if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE) {
+						bootloaderState = BOOTLOADER_STATE_PAGE_ERASE_WRITE;
+						flashWriteFlags = BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE;
+
+					} else {
+						bootloaderState = BOOTLOADER_STATE_PAGE_WRITE;
+						flashWriteFlags = 0;
+					}
 
 					currentAddress  = wIndex * SPM_PAGESIZE;
 					dataSize        = SPM_PAGESIZE;
 
 					// Multiple write
-					ret = 0xff;
+					ret = USB_NO_MSG;
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES) {
+					DBG(("WPGS"));
+
+					if (request->wValue.bytes[0] & BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE) {
+						bootloaderState = BOOTLOADER_STATE_PAGE_ERASE_WRITE;
+
+					} else {
+						bootloaderState = BOOTLOADER_STATE_PAGE_WRITE;
+					}
+
+					flashWriteFlags = request->wValue.bytes[0];
+
+					currentAddress  = wIndex * SPM_PAGESIZE;
+					dataSize        = request->wLength.word;
+
+					// Multiple write
+					ret = USB_NO_MSG;
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK) {
+					DBG(("EWRB"));
+
+					bootloaderState = BOOTLOADER_STATE_E2PROM_WRITE;
+
+					currentAddress  = wIndex;
+					dataSize        = request->wLength.word;
+
+					// Multiple write
+					ret = USB_NO_MSG;
 				}
 
 			} else {
@@ -166,9 +599,14 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 				if (request->bRequest == BOOTLOADER_COMMON_COMMAND_CONNECT) {
 					DBG(("CONN"));
 
+					memset(&flashReport, 0, sizeof(flashReport));
+
 					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
 
-				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_GET_INFO) {
+				} else if (
+					request->bRequest == BOOTLOADER_COMMON_COMMAND_GET_INFO ||
+					request->bRequest == BOOTLOADER_COMMON_COMMAND_HELLO
+				) {
 					DBG(("GETI"));
 
 					responseBuffer[ret + 0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
@@ -184,6 +622,15 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 
 					ret = 7;
 
+					if (request->bRequest == BOOTLOADER_COMMON_COMMAND_HELLO) {
+						memset(&flashReport, 0, sizeof(flashReport));
+
+						responseBuffer[ret + 0] = BOOTLOADER_CAPABILITIES & 0xff;
+						responseBuffer[ret + 1] = BOOTLOADER_CAPABILITIES >> 8;
+
+						ret = BOOTLOADER_COMMON_HELLO_RESPONSE_SIZE;
+					}
+
 				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE) {
 					bootloaderState = BOOTLOADER_STATE_PAGE_READ;
 
@@ -191,18 +638,43 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 					dataSize        = SPM_PAGESIZE;
 
 					// Multiple read
-					ret = 0xff;
+					ret = USB_NO_MSG;
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGES) {
+					DBG(("RPGS"));
+
+					bootloaderState = BOOTLOADER_STATE_PAGE_READ;
+
+					currentAddress  = wIndex * SPM_PAGESIZE;
+					dataSize        = request->wLength.word;
+
+					// Multiple read
+					ret = USB_NO_MSG;
 
 				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGE) {
 					DBG(("EPAG"));
 
-					cli();
-					boot_page_erase(wIndex * SPM_PAGESIZE);
-					sei();
+					_flashPageErase(wIndex * SPM_PAGESIZE);
+
+					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGES) {
+					DBG(("EPGS"));
 
-					boot_spm_busy_wait();
+					{
+						_U16 addr       = wIndex * SPM_PAGESIZE;
+						_U16 pagesCount = request->wValue.word;
 
-					boot_rww_enable();
+						// Host NAKs are answered by interrupt meanwhile, only watchdog has to be kept alive
+						while (pagesCount > 0) {
+							wdt_reset();
+
+							_flashPageErase(addr);
+
+							addr       += SPM_PAGESIZE;
+							pagesCount -= 1;
+						}
+					}
 
 					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
 
@@ -214,13 +686,112 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 
 					ret = 2;
 
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_READ_BLOCK) {
+					DBG(("EREB"));
+
+					bootloaderState = BOOTLOADER_STATE_E2PROM_READ;
+
+					currentAddress  = wIndex;
+					dataSize        = request->wLength.word;
+
+					// Multiple read
+					ret = USB_NO_MSG;
+
 				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE) {
 					DBG(("EWRA"));
 
-					_e2promWrite(wIndex, request->wValue.word);
+					_e2promQueuePush(wIndex, request->wValue.word);
 
 					responseBuffer[ret++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
 
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_REPORT) {
+					DBG(("FREP"));
+
+					// Pending pages are already programmed, every non-write command flushes them
+					responseBuffer[ret + 0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+					responseBuffer[ret + 1] = flashReport.pagesWritten & 0xff;
+					responseBuffer[ret + 2] = flashReport.pagesWritten >> 8;
+					responseBuffer[ret + 3] = flashReport.pagesUnchanged & 0xff;
+					responseBuffer[ret + 4] = flashReport.pagesUnchanged >> 8;
+					responseBuffer[ret + 5] = flashReport.pagesErased & 0xff;
+					responseBuffer[ret + 6] = flashReport.pagesErased >> 8;
+					responseBuffer[ret + 7] = flashReport.erasesSkipped & 0xff;
+					responseBuffer[ret + 8] = flashReport.erasesSkipped >> 8;
+
+					ret = BOOTLOADER_COMMON_FLASH_REPORT_RESPONSE_SIZE;
+
+					memset(&flashReport, 0, sizeof(flashReport));
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_GET_STATS) {
+					DBG(("STAT"));
+
+					// Copied, reply is sent after counters are cleared
+					responseBuffer[ret] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+
+					memcpy(&responseBuffer[ret + 1], &stats, sizeof(stats));
+
+					ret += 1 + sizeof(stats);
+
+					responseBuffer[ret + 0] = BOOTLOADER_SPM_TIMER_FREQUENCY & 0xff;
+					responseBuffer[ret + 1] = (BOOTLOADER_SPM_TIMER_FREQUENCY >> 8) & 0xff;
+					responseBuffer[ret + 2] = (BOOTLOADER_SPM_TIMER_FREQUENCY >> 16) & 0xff;
+					responseBuffer[ret + 3] = BOOTLOADER_SPM_TIMER_FREQUENCY >> 24;
+					responseBuffer[ret + 4] = watchdogResets & 0xff;
+					responseBuffer[ret + 5] = watchdogResets >> 8;
+					responseBuffer[ret + 6] = bootCheckTicks & 0xff;
+					responseBuffer[ret + 7] = bootCheckTicks >> 8;
+
+					ret = BOOTLOADER_COMMON_STATS_RESPONSE_SIZE;
+
+					if (request->wValue.bytes[0] & BOOTLOADER_COMMON_STATS_FLAG_CLEAR) {
+						memset(&stats, 0, sizeof(stats));
+					}
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_E2PROM_SYNC) {
+					DBG(("ESYN"));
+
+					// Queue is already flushed if host waits for it
+					{
+						_U8 pending = e2promQueueCount + (CHECK_BIT_AT(EECR, EEPE) ? 1 : 0);
+
+						responseBuffer[ret + 0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+						responseBuffer[ret + 1] = pending;
+						responseBuffer[ret + 2] = 0;
+
+						ret = 3;
+					}
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_CRC) {
+					DBG(("FCRC"));
+
+					{
+						_U16 addr     = wIndex * SPM_PAGESIZE;
+						_U16 endAddr  = addr + request->wValue.bytes[0] * SPM_PAGESIZE;
+						_U8  checksum = request->wValue.bytes[1];
+
+						while (addr < endAddr) {
+							checksum = crc8_update(checksum, pgm_read_byte(addr));
+
+							addr += 1;
+						}
+
+						responseBuffer[ret + 0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+						responseBuffer[ret + 1] = checksum;
+
+						ret = 2;
+					}
+
+				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_FLASH_PAGES_CRC) {
+					DBG(("PCRC"));
+
+					bootloaderState = BOOTLOADER_STATE_PAGES_CRC;
+
+					currentAddress  = wIndex * SPM_PAGESIZE;
+					dataSize        = request->wLength.word;
+
+					// Multiple read
+					ret = USB_NO_MSG;
+
 				} else if (request->bRequest == BOOTLOADER_COMMON_COMMAND_REBOOT) {
 					bootloaderState = BOOTLOADER_STATE_RESET;
 
@@ -231,6 +802,10 @@ usbMsgLen_t usbFunctionSetup(uchar data[8]) {
 	}
 
 funcRet:
+	if (ret != USB_NO_MSG) {
+		stats.bytesOut += ret;
+	}
+
 	usbMsgPtr = (usbMsgPtr_t) responseBuffer;
 
     return ret;
@@ -255,8 +830,50 @@ uchar usbFunctionRead(uchar *data, uchar len) {
 				break;
 			}
 		}
+
+	} else if (bootloaderState == BOOTLOADER_STATE_PAGES_CRC) {
+		while ((ret < len) && (dataSize > 0)) {
+			// Checksum of the next page is computed when its first byte is requested
+			if ((dataSize & 0x01) == 0) {
+				_U8 i = 0;
+
+				pageChecksum.word = PAGE_CHECKSUM_INITIAL;
+
+				do {
+					pageChecksum.word = _crc_ccitt_update(pageChecksum.word, pgm_read_byte(currentAddress++));
+
+					i += 1;
+				} while (i < SPM_PAGESIZE);
+
+				data[ret] = pageChecksum.bytes[0];
+
+			} else {
+				data[ret] = pageChecksum.bytes[1];
+			}
+
+			ret      += 1;
+			dataSize -= 1;
+		}
+
+		if (dataSize == 0) {
+			bootloaderState = BOOTLOADER_STATE_IDLE;
+		}
+
+	} else if (bootloaderState == BOOTLOADER_STATE_E2PROM_READ) {
+		while ((ret < len) && (dataSize > 0)) {
+			data[ret] = _e2promRead(currentAddress++);
+
+			ret      += 1;
+			dataSize -= 1;
+		}
+
+		if (dataSize == 0) {
+			bootloaderState = BOOTLOADER_STATE_IDLE;
+		}
 	}
 
+	stats.bytesOut += ret;
+
     return ret;
 }
 
@@ -266,42 +883,87 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
 
 	DBG(("write"));
 
-	if (bootloaderState == BOOTLOADER_STATE_PAGE_WRITE) {
-		_U8  idx  = 0;
-		_U16 addr = currentAddress + SPM_PAGESIZE - dataSize;
+	stats.bytesIn += len;
+
+	if (
+		bootloaderState == BOOTLOADER_STATE_PAGE_WRITE ||
+		bootloaderState == BOOTLOADER_STATE_PAGE_ERASE_WRITE
+	) {
+		_U8 idx = 0;
 
-		U16union *un = data;
+		U16union *un = (U16union *) data;
 
-		while (idx < len) {
-			// Address is incremented by 1 per one data word (2 bytes)
+		while ((idx < len) && (dataSize > 0)) {
 			DBG(("FP"));
 
-			cli();
-			boot_page_fill(addr, un->word);
-			sei();
+			// Packets are not aligned with pages, wait until staging buffer is free
+			while (stagingFull) {
+				_flashProgramPoll();
+			}
 
-			addr     += 2;
-			dataSize -= 2;
-			idx      += 2;
+			pageStaging[(currentAddress & (SPM_PAGESIZE - 1)) / 2].word = un->word;
+
+			currentAddress += 2;
+			dataSize       -= 2;
+			idx            += 2;
 
 			un += 1;
 
-			if (dataSize == 0) {
-				break;
+			// Program page as soon as it is received, transfer may carry more pages
+			if ((currentAddress & (SPM_PAGESIZE - 1)) == 0) {
+				DBG(("PC"));
+
+				stagingAddress = currentAddress - SPM_PAGESIZE;
+				stagingFlags   = flashWriteFlags;
+				stagingFull    = TRUE;
+
+				_flashProgramPoll();
+
+				// Previous page is still programmed, NAK next data until it is done.
+				// SETUP of the next request must not be NAKed, last page is staged here.
+				if (dataSize > 0) {
+					if (stagingFull) {
+						usbDisableAllRequests();
+					}
+
+				} else {
+					while (stagingFull) {
+						_flashProgramPoll();
+					}
+				}
 			}
 		}
 
 		if (dataSize == 0) {
-			DBG(("PC"));
+			bootloaderState = BOOTLOADER_STATE_IDLE;
 
-			cli();
-			boot_page_write(currentAddress);
-			sei();
+			ret = 1;
+		}
+
+	} else if (bootloaderState == BOOTLOADER_STATE_E2PROM_WRITE) {
+		_U8 idx = 0;
+
+		while ((idx < len) && (dataSize > 0)) {
+			_e2promQueuePush(currentAddress++, data[idx]);
+
+			idx      += 1;
+			dataSize -= 1;
+		}
 
-			boot_spm_busy_wait();
+		// Next packet would not fit, NAK it until queue is drained. After the
+		// last packet SETUP of the next request must not be NAKed, drained here.
+		if (dataSize > 0) {
+			if (e2promQueueCount > BOOTLOADER_E2PROM_QUEUE_SIZE - BOOTLOADER_E2PROM_QUEUE_RESERVE) {
+				usbDisableAllRequests();
+			}
 
-			boot_rww_enable();
+		} else {
+			while (e2promQueueCount > BOOTLOADER_E2PROM_QUEUE_SIZE - BOOTLOADER_E2PROM_QUEUE_RESERVE) {
+				_e2promQueuePoll();
+			}
+		}
 
+		if (dataSize == 0) {
 			bootloaderState = BOOTLOADER_STATE_IDLE;
 
 			ret = 1;
@@ -325,16 +987,61 @@ __attribute__((OS_main)) int main(void) {
 	SET_PIO_HIGH(PORTB, 1);
 #endif
 
+	// Free running timer measuring boot check and SPM busy time, clk / BOOTLOADER_SPM_TIMER_PRESCALER
+	TCCR1B = ONE_LEFT_SHIFTED(CS11) | ONE_LEFT_SHIFTED(CS10);
+
 	DBG(("C"));
 
+	// Counter is lost if application was running meanwhile or after power on
+	{
+		if (watchdogResetsCheck != (_U16) ~watchdogResets) {
+			watchdogResets = 0;
+		}
+
+		if ((resetFlags & ONE_LEFT_SHIFTED(WDRF)) && (rebootMarker != BOOTLOADER_REBOOT_MARKER)) {
+			watchdogResets++;
+		}
+
+		watchdogResetsCheck = ~watchdogResets;
+		rebootMarker        = 0;
+	}
+
 	_BOOL imageInFlashIsValid = FALSE;
 
-	{
+	// Check only used part of flash if image header is present
+	if (pgm_read_byte(BOOTLOADER_BYTE_APP_CRC8 + 1 - IMAGE_HEADER_OFFSET_MAGIC) == IMAGE_HEADER_MAGIC) {
+		_U16 length = pgm_read_word(BOOTLOADER_BYTE_APP_CRC8 + 1 - IMAGE_HEADER_OFFSET_LENGTH);
+
+		if (length <= BOOTLOADER_BYTE_IMAGE_HEADER) {
+			_U16 addr          = 0x0000;
+			_U8  imageChecksum = 0;
+
+			// Image followed by magic and length
+			while (addr < length) {
+				imageChecksum = crc8_update(imageChecksum, pgm_read_byte(addr));
+
+				addr += 1;
+			}
+
+			for (addr = BOOTLOADER_BYTE_IMAGE_HEADER; addr < BOOTLOADER_BYTE_APP_CRC8 + 1 - IMAGE_HEADER_OFFSET_CHECKSUM; addr++) {
+				imageChecksum = crc8_update(imageChecksum, pgm_read_byte(addr));
+			}
+
+			if (imageChecksum == pgm_read_byte(addr)) {
+				DBG(("HDR OK"));
+
+				imageInFlashIsValid = TRUE;
+			}
+		}
+	}
+
+	// Images committed without header are checked as a whole
+	if (! imageInFlashIsValid) {
 		_U16 addr         = 0x0000;
 		_U8 imageChecksum = 0;
 
 		while (addr < BOOTLOADER_BYTE_APP_CRC8) {
-			imageChecksum = crc8_getForByte(pgm_read_byte(addr), IMAGE_CHECKSUM_POLYNOMIAL, imageChecksum);
+			imageChecksum = crc8_update(imageChecksum, pgm_read_byte(addr));
 
 			addr += 1;
 		}
@@ -357,6 +1064,9 @@ __attribute__((OS_main)) int main(void) {
 		}
 	}
 
+	// Whole area check takes tens of milliseconds, timer overflows after 262 ms
+	bootCheckTicks = TCNT1;
+
 	SET_PIO_AS_INPUT(DECLARE_DDR(BOOTLOADER_ACTIVATION_PIO_BANK), BOOTLOADER_ACTIVATION_PIO_PIN);
 	SET_PIO_HIGH(DECLARE_PORT(BOOTLOADER_ACTIVATION_PIO_BANK), BOOTLOADER_ACTIVATION_PIO_PIN);
 
@@ -366,6 +1076,11 @@ __attribute__((OS_main)) int main(void) {
 	) {
 		SET_PIO_LOW(DECLARE_PORT(BOOTLOADER_ACTIVATION_PIO_BANK), BOOTLOADER_ACTIVATION_PIO_PIN);
 
+		// Application expects timer in its reset state
+		TCCR1B = 0;
+		TCNT1  = 0;
+		TIFR1  = ONE_LEFT_SHIFTED(ICF1) | ONE_LEFT_SHIFTED(OCF1B) | ONE_LEFT_SHIFTED(OCF1A) | ONE_LEFT_SHIFTED(TOV1);
+
 		void (*entryPoint)() = 0x0000;
 
 		entryPoint();
@@ -409,6 +1124,10 @@ __attribute__((OS_main)) int main(void) {
         wdt_reset();
 
         usbPoll();
+
+        _flashProgramPoll();
+
+        _e2promQueuePoll();
     }
 
 	DBG(("REBO"));
@@ -436,6 +1155,8 @@ __attribute__((OS_main)) int main(void) {
 		debug_terminate();
 #endif
 
+		rebootMarker = BOOTLOADER_REBOOT_MARKER;
+
 		wdt_enable(WDTO_15MS);
 
 		while (1) {
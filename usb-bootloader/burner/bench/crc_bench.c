@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bootloader/common/protocol.h"
+#include "burner/common/types.h"
+#include "burner/crc.h"
+
+
+// Whole ATmega328P application area, checksummed by every commit
+#define CRC_BENCH_BUFFER_SIZE (28 * 1024)
+#define CRC_BENCH_ROUNDS      2000
+
+
+// Bitwise implementations replaced by table driven ones, kept as reference
+static _U8 _crc8Bitwise(const _U8 *buffer, _U32 bufferSize, _U8 start) {
+	_U8  remainder = start;
+	_U32 byte;
+
+	for (byte = 0; byte < bufferSize; byte++) {
+		_U8 bit;
+
+		remainder ^= buffer[byte];
+
+		for (bit = 0; bit < 8; bit++) {
+			if (remainder & 0x01) {
+				remainder = (remainder >> 1) ^ IMAGE_CHECKSUM_POLYNOMIAL;
+
+			} else {
+				remainder = (remainder >> 1);
+			}
+		}
+	}
+
+	return remainder;
+}
+
+
+static _U16 _crc16Bitwise(const _U8 *buffer, _U32 bufferSize, _U16 start) {
+	_U16 remainder = start;
+	_U32 byte;
+
+	for (byte = 0; byte < bufferSize; byte++) {
+		_U8 bit;
+
+		remainder ^= buffer[byte];
+
+		for (bit = 0; bit < 8; bit++) {
+			if (remainder & 0x0001) {
+				remainder = (remainder >> 1) ^ PAGE_CHECKSUM_POLYNOMIAL;
+
+			} else {
+				remainder = (remainder >> 1);
+			}
+		}
+	}
+
+	return remainder;
+}
+
+
+static _U64 _getTimeUs(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (_U64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void _report(const char *name, _U64 time) {
+	_U64 bytes = (_U64) CRC_BENCH_BUFFER_SIZE * CRC_BENCH_ROUNDS;
+
+	printf("  %-16s %10llu us %10.1f MB/s\n", name, (unsigned long long) time, (double) bytes / (time > 0 ? time : 1));
+}
+
+
+int main(int argc, char *argv[]) {
+	_U8            *buffer;
+	volatile _U32   sink = 0;
+	_U64            startTime;
+	_U32            i;
+
+	buffer = malloc(CRC_BENCH_BUFFER_SIZE);
+	if (buffer == NULL) {
+		return 1;
+	}
+
+	srand(1);
+
+	for (i = 0; i < CRC_BENCH_BUFFER_SIZE; i++) {
+		buffer[i] = rand();
+	}
+
+	// Every length exercises both sliced and byte wise tail of table driven code
+	for (i = 0; i < 64; i++) {
+		if (
+			(crc8_get(buffer + i, CRC_BENCH_BUFFER_SIZE - 64 - i, 0x5a)                   != _crc8Bitwise(buffer + i, CRC_BENCH_BUFFER_SIZE - 64 - i, 0x5a)) ||
+			(crc16_get(buffer + i, CRC_BENCH_BUFFER_SIZE - 64 - i, PAGE_CHECKSUM_INITIAL) != _crc16Bitwise(buffer + i, CRC_BENCH_BUFFER_SIZE - 64 - i, PAGE_CHECKSUM_INITIAL))
+		) {
+			printf("Checksums differ for offset %d!\n", i);
+
+			free(buffer);
+
+			return 1;
+		}
+	}
+
+	printf("%d rounds over %d bytes:\n", CRC_BENCH_ROUNDS, CRC_BENCH_BUFFER_SIZE);
+
+	startTime = _getTimeUs();
+	for (i = 0; i < CRC_BENCH_ROUNDS; i++) {
+		sink += _crc8Bitwise(buffer, CRC_BENCH_BUFFER_SIZE, i);
+	}
+	_report("crc8 bitwise", _getTimeUs() - startTime);
+
+	startTime = _getTimeUs();
+	for (i = 0; i < CRC_BENCH_ROUNDS; i++) {
+		sink += crc8_get(buffer, CRC_BENCH_BUFFER_SIZE, i);
+	}
+	_report("crc8 table", _getTimeUs() - startTime);
+
+	startTime = _getTimeUs();
+	for (i = 0; i < CRC_BENCH_ROUNDS; i++) {
+		sink += _crc16Bitwise(buffer, CRC_BENCH_BUFFER_SIZE, i);
+	}
+	_report("crc16 bitwise", _getTimeUs() - startTime);
+
+	startTime = _getTimeUs();
+	for (i = 0; i < CRC_BENCH_ROUNDS; i++) {
+		sink += crc16_get(buffer, CRC_BENCH_BUFFER_SIZE, i);
+	}
+	_report("crc16 table", _getTimeUs() - startTime);
+
+	free(buffer);
+
+	return 0;
+}
@@ -6,6 +6,97 @@
 
 #define BOOTLOADER_TIMEOUT_INFINITY 0xffffffff
 
+#define BOOTLOADER_DEVICE_ID_LENGTH_MAX 32
+
+// Maximal number of flash pages written by single queued transfer
+#define BOOTLOADER_WRITE_QUEUE_PAGES_MAX 16
+
+
+typedef enum _BootloaderTransport {
+	BOOTLOADER_TRANSPORT_LIBUSB,
+	BOOTLOADER_TRANSPORT_SIMULATOR
+} BootloaderTransport;
+
+
+// Connection with single device, calls on different contexts may run in parallel
+typedef struct _Bootloader Bootloader;
+
+
+// Pages written through write queue, finished transfers are taken in submission order
+typedef struct _BootloaderWriteQueue BootloaderWriteQueue;
+
+
+// Device location on the bus, in '<bus>:<address>' form
+typedef struct _BootloaderDeviceId {
+	char name[BOOTLOADER_DEVICE_ID_LENGTH_MAX];
+} BootloaderDeviceId;
+
+
+// Classes of commands with separate latency accounting
+typedef enum _BootloaderCommandType {
+	BOOTLOADER_COMMAND_TYPE_CONNECT,
+	BOOTLOADER_COMMAND_TYPE_RESET,
+	BOOTLOADER_COMMAND_TYPE_ERASE,
+	BOOTLOADER_COMMAND_TYPE_WRITE,
+	BOOTLOADER_COMMAND_TYPE_READ,
+	BOOTLOADER_COMMAND_TYPE_CHECKSUM,
+	BOOTLOADER_COMMAND_TYPE_E2PROM_READ,
+	BOOTLOADER_COMMAND_TYPE_E2PROM_WRITE,
+
+	BOOTLOADER_COMMAND_TYPES_COUNT
+} BootloaderCommandType;
+
+
+// Times are in microseconds
+typedef struct _BootloaderCommandStatistics {
+	_U32 count;
+	_U32 errors;
+	_U64 bytes;
+	_U64 timeTotal;
+	_U32 timeMin;
+	_U32 timeAverage;
+	_U32 timeP99;
+	_U32 timeMax;
+} BootloaderCommandStatistics;
+
+
+typedef struct _BootloaderStatistics {
+	_U64                        time; // Since connection or previous clear
+	BootloaderCommandStatistics commands[BOOTLOADER_COMMAND_TYPES_COUNT];
+} BootloaderStatistics;
+
+
+// Work done by device since connection or previous report
+typedef struct _BootloaderFlashReport {
+	_U32 pagesWritten;
+	_U32 pagesUnchanged; // Page already held written data
+	_U32 pagesErased;
+	_U32 erasesSkipped;  // Page to erase was already blank
+} BootloaderFlashReport;
+
+
+// Counted by device since its start or previous clear
+typedef struct _BootloaderDeviceStatistics {
+	_U32 setupRequests;
+	_U32 bytesIn;        // Received by device
+	_U32 bytesOut;       // Sent by device
+	_U32 pagesErased;
+	_U32 pagesWritten;
+	_U64 spmBusyTime;    // Microseconds spent by flash erase and programming
+	_U32 watchdogResets; // Not requested by host, kept when cleared
+	_U32 bootCheckTime;  // Microseconds spent by image check at boot, kept when cleared
+} BootloaderDeviceStatistics;
+
+
+// Pages checksums are valid only if queue computes them and checksumResult is COMMON_NO_ERROR
+typedef struct _BootloaderQueuedWrite {
+	_U32        firstPage;
+	_U32        pagesCount;
+	CommonError result;
+	CommonError checksumResult;
+	_U16        pagesCrc[BOOTLOADER_WRITE_QUEUE_PAGES_MAX];
+} BootloaderQueuedWrite;
+
 
 typedef struct _BootloaderTargetInformation {
 	struct {
@@ -18,8 +109,9 @@ typedef struct _BootloaderTargetInformation {
 	} e2prom;
 
 	struct {
-		_U8 versionMajor;
-		_U8 versionMinor;
+		_U8  versionMajor;
+		_U8  versionMinor;
+		_U16 capabilities; // BOOTLOADER_COMMON_CAPABILITY_* bits
 	} bootloader;
 
 	struct {
@@ -28,24 +120,75 @@ typedef struct _BootloaderTargetInformation {
 } BootloaderTargetInformation;
 
 
-CommonError bootloader_initialize(void);
+CommonError bootloader_initialize(BootloaderTransport transport, const char *transportParameter);
 
 CommonError bootloader_terminate(void);
 
-CommonError bootloader_connect(BootloaderTargetInformation *targetInformation, _U32 timeout);
+CommonError bootloader_enumerate(BootloaderDeviceId *devices, _U32 devicesMax, _U32 *devicesCount);
+
+// Connects to device with given id or to the first found one if deviceId is NULL
+CommonError bootloader_connect(Bootloader **bootloader, const char *deviceId, BootloaderTargetInformation *targetInformation, _U32 timeout);
+
+CommonError bootloader_disconnect(Bootloader *bootloader);
+
+CommonError bootloader_reset(Bootloader *bootloader, _U32 timeout);
+
+CommonError bootloader_flashPageErase(Bootloader *bootloader, _U32 pageumber, _U32 timeout);
+
+// Erases range of pages in one request, timeout is extended by expected erase time of all pages
+CommonError bootloader_flashPagesErase(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U32 timeout);
+
+CommonError bootloader_flashPageRead(Bootloader *bootloader, _U32 pageumber, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferReadSize);
+
+CommonError bootloader_flashPageWrite(Bootloader *bootloader, _U32 pageumber, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferWritten);
+
+CommonError bootloader_flashPageEraseWrite(Bootloader *bootloader, _U32 pageNumber, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferWritten);
+
+CommonError bootloader_flashPagesRead(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 *buffer, _U32 timeout);
+
+CommonError bootloader_flashPagesWrite(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 *buffer, _BOOL erase, _U32 timeout);
+
+/*
+ * Keeps up to depth page writes in flight, every write is followed by checksum
+ * read of its pages if requested. Returns COMMON_ERROR_NOT_SUPPORTED if device
+ * can not do that by single transfers or transport can not queue them.
+ */
+CommonError bootloader_writeQueueOpen(Bootloader *bootloader, _U32 depth, _BOOL checksum, BootloaderWriteQueue **queue);
+
+// Returns COMMON_ERROR_NO_FREE_RESOURCES if depth writes are already pending, timeout counts from submission
+CommonError bootloader_writeQueueSubmit(BootloaderWriteQueue *queue, _U32 firstPage, _U32 pagesCount, _U8 *buffer, _BOOL erase, _U32 timeout);
+
+// Number of submitted writes not yet taken by bootloader_writeQueueReap()
+_U32 bootloader_writeQueuePending(BootloaderWriteQueue *queue);
+
+// Takes the oldest write if it is finished, waits for it if requested
+_BOOL bootloader_writeQueueReap(BootloaderWriteQueue *queue, _BOOL wait, BootloaderQueuedWrite *write);
+
+// Waits for transfers in flight, results not taken are dropped
+void bootloader_writeQueueClose(BootloaderWriteQueue *queue);
+
+CommonError bootloader_flashCrc(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 crcStart, _U8 *crc, _U32 timeout);
+
+CommonError bootloader_flashPagesCrc(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U16 *pagesCrc, _U32 timeout);
+
+// Returns COMMON_ERROR_NOT_SUPPORTED if bootloader does not compare pages before programming
+CommonError bootloader_flashReport(Bootloader *bootloader, BootloaderFlashReport *report, _U32 timeout);
 
-CommonError bootloader_disconnect(void);
+// Returns COMMON_ERROR_NOT_SUPPORTED if bootloader does not count its work
+CommonError bootloader_getDeviceStatistics(Bootloader *bootloader, _BOOL clear, BootloaderDeviceStatistics *statistics, _U32 timeout);
 
-CommonError bootloader_reset(_U32 timeout);
+CommonError bootloader_e2promRead(Bootloader *bootloader, _U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferReadSize);
 
-CommonError bootloader_flashPageErase(_U32 pageumber, _U32 timeout);
+CommonError bootloader_e2promWrite(Bootloader *bootloader, _U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferWritten);
 
-CommonError bootloader_flashPageRead(_U32 pageumber, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferReadSize);
+// Returns count of e2prom bytes queued by device and not yet written, waits for all of them if requested
+CommonError bootloader_e2promSync(Bootloader *bootloader, _BOOL wait, _U32 *pending, _U32 timeout);
 
-CommonError bootloader_flashPageWrite(_U32 pageumber, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferWritten);
+// Latency of commands issued since connection or previous clear
+CommonError bootloader_getStatistics(Bootloader *bootloader, BootloaderStatistics *statistics);
 
-CommonError bootloader_e2promRead(_U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferReadSize);
+void bootloader_clearStatistics(Bootloader *bootloader);
 
-CommonError bootloader_e2promWrite(_U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferWritten);
+const char *bootloader_commandTypeName(BootloaderCommandType type);
 
 #endif /* BOOTLOADER_H_ */
@@ -0,0 +1,18 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include "common/types.h"
+
+
+/*
+ * Last known flash content of a device. Pages are not guaranteed to be
+ * still valid, caller has to compare them with device reported checksums.
+ */
+
+// Returns COMMON_ERROR_NO_DEVICE if there is no cache or it was made for other flash geometry
+CommonError cache_load(const char *path, _U32 pageSize, _U32 pagesCount, _U8 *buffer, _BOOL *pagesKnown);
+
+// Only pages marked as known are stored, file is replaced atomically
+CommonError cache_store(const char *path, _U32 pageSize, _U32 pagesCount, const _U8 *buffer, const _BOOL *pagesKnown);
+
+#endif /* CACHE_H_ */
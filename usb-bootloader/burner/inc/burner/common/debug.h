@@ -44,8 +44,9 @@
 	#define DBG(x)    {}
 #endif
 
-#define REPORT(x) { printf x; printf("\n"); }
-#define REPORT_ERR(x) { printf("!!!! ERROR !!!!"); printf x; printf(" !!!!\n"); }
+// Lines are printed atomically, reports may come from concurrent device workers
+#define REPORT(x) { flockfile(stdout); printf x; printf("\n"); funlockfile(stdout); }
+#define REPORT_ERR(x) { flockfile(stdout); printf("!!!! ERROR !!!!"); printf x; printf(" !!!!\n"); funlockfile(stdout); }
 
 #if defined(ENABLE_DEBUG)
 #define ASSERT(x) { if ((x) != TRUE) { FATAL(("ASSERT!!! ("#x") != TRUE")); abort(); } }
@@ -10,6 +10,8 @@ typedef int16_t  _S16;
 typedef uint16_t _U16;
 typedef int32_t  _S32;
 typedef uint32_t _U32;
+typedef int64_t  _S64;
+typedef uint64_t _U64;
 
 typedef _U8 _BOOL;
 
@@ -27,7 +29,8 @@ typedef enum _CommonError {
 	COMMON_ERROR_TIMEOUT,
 	COMMON_ERROR_BAD_PARAMETER,
 	COMMON_ERROR_NO_FREE_RESOURCES,
-	COMMON_ERROR_NO_DEVICE
+	COMMON_ERROR_NO_DEVICE,
+	COMMON_ERROR_NOT_SUPPORTED
 } CommonError;
 
 #endif /* BURNER_COMMON_TYPES_H_ */
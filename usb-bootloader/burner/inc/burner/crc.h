@@ -0,0 +1,16 @@
+#ifndef CRC_H_
+#define CRC_H_
+
+#include "common/types.h"
+
+
+/*
+ * Image checksum, reflected CRC-8 with IMAGE_CHECKSUM_POLYNOMIAL. Gives the
+ * same result as bootloader for the same start remainder.
+ */
+_U8 crc8_get(const _U8 *buffer, _U32 bufferSize, _U8 start);
+
+// Page checksum, reflected CRC-16-CCITT (PAGE_CHECKSUM_POLYNOMIAL)
+_U16 crc16_get(const _U8 *buffer, _U32 bufferSize, _U16 start);
+
+#endif /* CRC_H_ */
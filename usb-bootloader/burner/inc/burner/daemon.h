@@ -0,0 +1,20 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include "common/types.h"
+
+
+// Executes single request, everything printed to stdout is passed to client
+typedef CommonError (*DaemonRequestHandler)(int argc, char *argv[], void *context);
+
+
+/*
+ * Serves requests sent by daemon_request() on unix socket until SIGINT or
+ * SIGTERM. Requests are handled one by one in working directory of the client.
+ */
+CommonError daemon_run(const char *socketPath, DaemonRequestHandler handler, void *context);
+
+// Passes arguments to daemon, prints its output and returns request status
+CommonError daemon_request(const char *socketPath, int argc, char *argv[], CommonError *result);
+
+#endif /* DAEMON_H_ */
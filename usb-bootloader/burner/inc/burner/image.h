@@ -0,0 +1,45 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include "common/types.h"
+
+
+typedef enum _ImageFormat {
+	IMAGE_FORMAT_BINARY,
+	IMAGE_FORMAT_IHEX,
+	IMAGE_FORMAT_ELF
+} ImageFormat;
+
+
+// Address space of ELF segments placed into the image
+typedef enum _ImageMemory {
+	IMAGE_MEMORY_FLASH,
+	IMAGE_MEMORY_E2PROM
+} ImageMemory;
+
+
+typedef struct _ImageSegment {
+	_U32  address;
+	_U32  size;
+	_U8  *data;
+} ImageSegment;
+
+
+typedef struct _Image {
+	ImageFormat   format;
+	ImageSegment *segments;
+	_U32          segmentsCount;
+} Image;
+
+
+/*
+ * Loads Intel HEX, ELF (PT_LOAD segments) or raw binary file. Format is
+ * detected from file content, raw binary is placed at given offset. Only
+ * ELF segments of given memory are loaded, e2prom ones are rebased to 0.
+ * Overlapping data is rejected.
+ */
+CommonError image_load(const char *path, _U32 binaryOffset, ImageMemory memory, Image *image);
+
+void image_free(Image *image);
+
+#endif /* IMAGE_H_ */
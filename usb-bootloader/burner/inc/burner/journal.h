@@ -0,0 +1,30 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "common/types.h"
+#include "image.h"
+
+
+// Pages of one image already written and verified on one device
+typedef struct _Journal Journal;
+
+
+// Identifies image content, journal of other image is not reused
+_U64 journal_imageHash(const Image *image);
+
+/*
+ * Opens journal file, creating it if needed. Entries left by an interrupted
+ * run are kept only if they were recorded for image with the same hash.
+ */
+CommonError journal_open(Journal **journal, const char *path, _U64 imageHash);
+
+// Page is done if it was recorded with the same checksum
+_BOOL journal_isPageDone(Journal *journal, _U32 page, _U16 pageCrc);
+
+// Records consecutive pages with their checksums, flushed to disk before return
+CommonError journal_pagesDone(Journal *journal, _U32 firstPage, _U32 pagesCount, const _U16 *pagesCrc);
+
+// Journal of completed write is not needed anymore and is removed
+void journal_close(Journal *journal, _BOOL remove);
+
+#endif /* JOURNAL_H_ */
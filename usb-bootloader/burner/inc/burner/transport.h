@@ -0,0 +1,68 @@
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include "common/types.h"
+
+
+#define TRANSPORT_TIMEOUT_INFINITY 0xffffffff
+
+#define TRANSPORT_DEVICE_ID_LENGTH_MAX 32
+
+
+typedef enum _TransportDirection {
+	TRANSPORT_DIRECTION_IN,
+	TRANSPORT_DIRECTION_OUT
+} TransportDirection;
+
+
+typedef struct _TransportDevice TransportDevice;
+
+
+// Called when submitted transfer is finished, result as returned by controlMsg
+typedef void (*TransportCompletion)(_S32 result, void *context);
+
+
+// Device location formatted as '<bus>:<address>' with three digit numbers
+typedef struct _TransportDeviceId {
+	char name[TRANSPORT_DEVICE_ID_LENGTH_MAX];
+} TransportDeviceId;
+
+
+/*
+ * Transport backend used by bootloader API to exchange vendor control
+ * requests with jboot device.
+ */
+typedef struct _Transport {
+	const char *name;
+
+	CommonError (*initialize)(const char *parameter);
+
+	CommonError (*terminate)(void);
+
+	// Lists currently attached devices with jboot bootloader
+	CommonError (*enumerate)(TransportDeviceId *ids, _U32 idsMax, _U32 *idsCount);
+
+	// Waits up to timeout for device with jboot bootloader (any one if id is NULL) and opens it
+	CommonError (*open)(TransportDevice **device, const char *id, _U32 timeout);
+
+	void (*close)(TransportDevice *device);
+
+	// Returns number of transferred bytes or negative value on error
+	_S32 (*controlMsg)(TransportDevice *device, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout);
+
+	/*
+	 * Queues transfer and returns without waiting for it. Buffer has to be
+	 * valid until completion is called, which may happen from another thread.
+	 * Transfers submitted for one device are done in submission order.
+	 */
+	CommonError (*controlMsgSubmit)(TransportDevice *device, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout, TransportCompletion completion, void *context);
+
+	const char *(*strerror)(void);
+} Transport;
+
+
+extern const Transport transportLibusb;
+
+extern const Transport transportSimulator;
+
+#endif /* TRANSPORT_H_ */
@@ -1,15 +1,38 @@
-#include <usb.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "bootloader/common/protocol.h"
 #include "burner/bootloader.h"
+#include "burner/transport.h"
 
 #define DEBUG_LEVEL 4
 #include "burner/common/debug.h"
 
 
-#define BOOTLOADER_CHECK_DEVICES_INTERVAL 200
+// Maximal size of single e2prom block transfer (V-USB limit without long transfers is 254 bytes)
+#define BOOTLOADER_E2PROM_BLOCK_SIZE 128
+
+// Maximal number of page checksums returned by single transfer (2 bytes per page)
+#define BOOTLOADER_PAGES_CRC_BLOCK_SIZE 127
+
+// Maximal number of flash pages carried by single long transfer
+#define BOOTLOADER_PAGES_PER_TRANSFER 16
+
+// Upper bound of single flash page erase time (datasheet: 3.7 - 4.5 ms)
+#define BOOTLOADER_PAGE_ERASE_TIME_MS 5
+
+// Number of devices whose handshake result is remembered
+#define BOOTLOADER_INFORMATION_CACHE_SIZE 16
+
+// Initial capacity of latency samples list, doubled when full
+#define BOOTLOADER_STATISTICS_SAMPLES_INITIAL 64
+
+// Transfers done by statistics and progress queries are not user commands
+#define BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED BOOTLOADER_COMMAND_TYPES_COUNT
 
 
 typedef struct _McuParameters {
@@ -45,25 +68,87 @@ typedef struct _McuInformation {
 	} signature;
 
 	_U16 bootloaderSizeInPages;
+
+	_U16 capabilities; // BOOTLOADER_COMMON_CAPABILITY_* bits
+	_BOOL hello;       // HELLO command is supported
 } McuInformation;
 
 
-typedef struct _BootloaderPrivateData {
-	usb_dev_handle *deviceHandle;
-	McuParameters  *mcuParameters;
-	_U32            bootloaderSectionSize;
-} BootloaderPrivateData;
+// Handshake result of device, it is reused on reconnection by the same device id
+typedef struct _McuInformationCacheEntry {
+	BootloaderDeviceId           deviceId;
+	McuInformation               info;
+	McuParameters               *mcuParameters;
+	BootloaderTargetInformation  target;
+	_BOOL                        valid;
+} McuInformationCacheEntry;
+
+
+// Every latency is kept to compute percentiles, flashing issues at most few thousands of commands
+typedef struct _CommandStatistics {
+	_U32  count;
+	_U32  errors;
+	_U64  bytes;
+	_U32 *samples;
+	_U32  samplesSize;
+} CommandStatistics;
+
+
+struct _Bootloader {
+	TransportDevice   *device;
+	McuParameters     *mcuParameters;
+	McuInformation     mcuInformation;
+	_U32               bootloaderSectionSize;
+	_U64               statisticsStart;
+	CommandStatistics  statistics[BOOTLOADER_COMMAND_TYPES_COUNT];
+	pthread_mutex_t    statisticsMutex; // Queued transfers are accounted from transport thread
+};
+
+
+typedef struct _WriteQueueSlot {
+	BootloaderWriteQueue  *queue;
+	BootloaderQueuedWrite  write;
+	_U8                    crcResponse[BOOTLOADER_WRITE_QUEUE_PAGES_MAX * 2];
+	_U32                   transfersLeft;
+	_U64                   submitTime;
+} WriteQueueSlot;
+
+
+struct _BootloaderWriteQueue {
+	Bootloader      *bootloader;
+	WriteQueueSlot  *slots;
+	_U32             depth;
+	_U32             head;             // The oldest write not yet reaped
+	_U32             count;            // Writes not yet reaped
+	_U32             transfersPending; // Transfers submitted and not completed
+	_U64             lastCompletion;
+	_BOOL            checksum;
+	pthread_mutex_t  mutex;
+	pthread_cond_t   cond;
+};
 
 
 static _BOOL initialized = FALSE;
 
-BootloaderPrivateData privateData;
+// Selected once by bootloader_initialize(), read only afterwards
+static const Transport *transport = NULL;
+
+static const char *commandTypeNames[BOOTLOADER_COMMAND_TYPES_COUNT] = {
+	[BOOTLOADER_COMMAND_TYPE_CONNECT]      = "connect",
+	[BOOTLOADER_COMMAND_TYPE_RESET]        = "reset",
+	[BOOTLOADER_COMMAND_TYPE_ERASE]        = "erase",
+	[BOOTLOADER_COMMAND_TYPE_WRITE]        = "write",
+	[BOOTLOADER_COMMAND_TYPE_READ]         = "read",
+	[BOOTLOADER_COMMAND_TYPE_CHECKSUM]     = "checksum",
+	[BOOTLOADER_COMMAND_TYPE_E2PROM_READ]  = "e2prom-read",
+	[BOOTLOADER_COMMAND_TYPE_E2PROM_WRITE] = "e2prom-write"
+};
+
+static McuInformationCacheEntry informationCache[BOOTLOADER_INFORMATION_CACHE_SIZE];
 
-static const _U16 idVendor  = 0x16c0;
-static const _U16 idProduct = 0x05dc;
+static _U32 informationCacheNext = 0;
 
-static const char *deviceName = "USB jboot";
-static const char *vendorName = "obdev.at";
+static pthread_mutex_t informationCacheMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static McuParameters mcu[] = {
 	{
@@ -74,22 +159,93 @@ static McuParameters mcu[] = {
 			.pageSize = 128,
 		},
 		.e2prom = {
-			.size = 2 * 1024,
+			.size = 1 * 1024,
 		}
 	}
 };
 
 
-static CommonError _mcuCommandConnect(_U32 timeout) {
+static _U64 _getTimeUs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (_U64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void _statisticsAdd(Bootloader *bootloader, BootloaderCommandType type, _S32 transferred, _U32 time) {
+	CommandStatistics *statistics = &bootloader->statistics[type];
+
+	pthread_mutex_lock(&bootloader->statisticsMutex);
+
+	do {
+		if (statistics->count == statistics->samplesSize) {
+			_U32  samplesSize = (statistics->samplesSize == 0) ? BOOTLOADER_STATISTICS_SAMPLES_INITIAL : statistics->samplesSize * 2;
+			_U32 *samples     = realloc(statistics->samples, samplesSize * sizeof(*samples));
+
+			// Accounting must not break transfers, sample is lost
+			if (samples == NULL) {
+				break;
+			}
+
+			statistics->samples     = samples;
+			statistics->samplesSize = samplesSize;
+		}
+
+		statistics->samples[statistics->count++] = time;
+
+		if (transferred < 0) {
+			statistics->errors++;
+
+		} else {
+			statistics->bytes += transferred;
+		}
+	} while (0);
+
+	pthread_mutex_unlock(&bootloader->statisticsMutex);
+}
+
+
+static void _statisticsFree(Bootloader *bootloader) {
+	_U32 i;
+
+	for (i = 0; i < BOOTLOADER_COMMAND_TYPES_COUNT; i++) {
+		if (bootloader->statistics[i].samples != NULL) {
+			free(bootloader->statistics[i].samples);
+		}
+	}
+
+	memset(bootloader->statistics, 0, sizeof(bootloader->statistics));
+}
+
+
+// Every command goes through here to have its latency accounted
+static _S32 _controlMsg(Bootloader *bootloader, BootloaderCommandType type, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout) {
+	_U64 startTime = _getTimeUs();
+	_S32 ret;
+
+	ret = transport->controlMsg(bootloader->device, direction, request, value, index, buffer, bufferSize, timeout);
+
+	if (type != BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED) {
+		_statisticsAdd(bootloader, type, ret, _getTimeUs() - startTime);
+	}
+
+	return ret;
+}
+
+
+static CommonError _mcuCommandConnect(Bootloader *bootloader, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 usbRet;
 		_U8  response;
 
-		usbRet = usb_control_msg(
-			privateData.deviceHandle,
-			USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_CONNECT,
+			TRANSPORT_DIRECTION_IN,
 			BOOTLOADER_COMMON_COMMAND_CONNECT,
 			0,
 			0,
@@ -98,7 +254,7 @@ static CommonError _mcuCommandConnect(_U32 timeout) {
 			timeout
 		);
 		if (usbRet < 0) {
-			ERR(("_mcuCommandConnect(): USB error '%s'!", usb_strerror()));
+			ERR(("_mcuCommandConnect(): USB error '%s'!", transport->strerror()));
 
 			ret = COMMON_ERROR;
 			break;
@@ -123,16 +279,17 @@ static CommonError _mcuCommandConnect(_U32 timeout) {
 }
 
 
-static CommonError _mcuCommandGetInfo(McuInformation *info, _U32 timeout) {
+static CommonError _mcuCommandGetInfo(Bootloader *bootloader, McuInformation *info, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 usbRet;
 		_U8  response[8] = { 0 };
 
-		usbRet = usb_control_msg(
-			privateData.deviceHandle,
-			USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_CONNECT,
+			TRANSPORT_DIRECTION_IN,
 			BOOTLOADER_COMMON_COMMAND_GET_INFO,
 			0,
 			0,
@@ -141,7 +298,7 @@ static CommonError _mcuCommandGetInfo(McuInformation *info, _U32 timeout) {
 			timeout
 		);
 		if (usbRet < 0) {
-			ERR(("_mcuCommandGetInfo(): USB error '%s'!", usb_strerror()));
+			ERR(("_mcuCommandGetInfo(): USB error '%s'!", transport->strerror()));
 
 			ret = COMMON_ERROR;
 			break;
@@ -180,16 +337,85 @@ static CommonError _mcuCommandGetInfo(McuInformation *info, _U32 timeout) {
 }
 
 
-static CommonError _mcuCommandReboot(_U32 timeout) {
+// Returns COMMON_ERROR_NOT_SUPPORTED if bootloader does not know HELLO
+static CommonError _mcuCommandHello(Bootloader *bootloader, McuInformation *info, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		_S32 usbRet;
+		_U8  response[BOOTLOADER_COMMON_HELLO_RESPONSE_SIZE] = { 0 };
+
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_CONNECT,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_HELLO,
+			0,
+			0,
+			response,
+			sizeof(response),
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandHello(): USB error '%s'!", transport->strerror()));
+
+			ret = COMMON_ERROR;
+			break;
+		}
+
+		// Unknown commands are answered with empty response
+		if (usbRet == 0) {
+			ret = COMMON_ERROR_NOT_SUPPORTED;
+			break;
+		}
+
+		if (usbRet != BOOTLOADER_COMMON_HELLO_RESPONSE_SIZE) {
+			ERR(("_mcuCommandHello(): Bad response length! (%d)", usbRet));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		if (response[0] != BOOTLOADER_COMMON_COMMAND_STATUS_OK) {
+			ERR(("_mcuCommandHello(): Bad response! %#x", response[0]));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		info->bootloaderVersion.major = response[1];
+		info->bootloaderVersion.minor = response[2];
+
+		info->bootloaderSizeInPages   = response[3];
+
+		info->signature.byte1         = response[4];
+		info->signature.byte2         = response[5];
+		info->signature.byte3         = response[6];
+
+		info->capabilities            = response[7] | (response[8] << 8);
+		info->hello                   = TRUE;
+
+		DBG(("_mcuCommandHello(): Bootloader version: %d.%d, sizeInPages: %d, signature: %02x %02x %02x, capabilities: %04x",
+			info->bootloaderVersion.major, info->bootloaderVersion.minor, info->bootloaderSizeInPages,
+			info->signature.byte1, info->signature.byte2, info->signature.byte3, info->capabilities
+		));
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _mcuCommandReboot(Bootloader *bootloader, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 usbRet;
 		_U8 response;
 
-		usbRet = usb_control_msg(
-			privateData.deviceHandle,
-			USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_RESET,
+			TRANSPORT_DIRECTION_IN,
 			BOOTLOADER_COMMON_COMMAND_REBOOT,
 			0,
 			0,
@@ -198,7 +424,7 @@ static CommonError _mcuCommandReboot(_U32 timeout) {
 			timeout
 		);
 		if (usbRet < 0) {
-			ERR(("_mcuCommandReboot(): USB error '%s'!", usb_strerror()));
+			ERR(("_mcuCommandReboot(): USB error '%s'!", transport->strerror()));
 
 			ret = COMMON_ERROR;
 			break;
@@ -223,16 +449,17 @@ static CommonError _mcuCommandReboot(_U32 timeout) {
 }
 
 
-static CommonError _mcuCommandFlashPageErase(_U32 pageNumber, _U32 timeout) {
+static CommonError _mcuCommandFlashPageErase(Bootloader *bootloader, _U32 pageNumber, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 usbRet;
 		_U8  response;
 
-		usbRet = usb_control_msg(
-			privateData.deviceHandle,
-			USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_ERASE,
+			TRANSPORT_DIRECTION_IN,
 			BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGE,
 			0,
 			pageNumber,
@@ -241,7 +468,7 @@ static CommonError _mcuCommandFlashPageErase(_U32 pageNumber, _U32 timeout) {
 			timeout
 		);
 		if (usbRet < 0) {
-			ERR(("_mcuCommandFlashPageErase(): USB error '%s'!", usb_strerror()));
+			ERR(("_mcuCommandFlashPageErase(): USB error '%s'!", transport->strerror()));
 
 			ret = COMMON_ERROR;
 			break;
@@ -266,16 +493,54 @@ static CommonError _mcuCommandFlashPageErase(_U32 pageNumber, _U32 timeout) {
 }
 
 
-static CommonError _mcuCommandFlashPageRead(_U32 pageNumber, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
+static CommonError _mcuCommandFlashPagesErase(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		_S32 usbRet;
+		_U8  response;
+
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_ERASE,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGES,
+			pagesCount,
+			firstPage,
+			&response,
+			1,
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandFlashPagesErase(): USB error '%s'!", transport->strerror()));
+
+			ret = COMMON_ERROR;
+			break;
+		}
+
+		if ((usbRet != 1) || (response != BOOTLOADER_COMMON_COMMAND_STATUS_OK)) {
+			ERR(("_mcuCommandFlashPagesErase(): Bad response!"));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _mcuCommandFlashPageRead(Bootloader *bootloader, _U8 command, _U32 pageNumber, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 usbRet;
 
-		usbRet = usb_control_msg(
-			privateData.deviceHandle,
-			USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
-			BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE,
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_READ,
+			TRANSPORT_DIRECTION_IN,
+			command,
 			0,
 			pageNumber,
 			buffer,
@@ -283,7 +548,7 @@ static CommonError _mcuCommandFlashPageRead(_U32 pageNumber, _U8 *buffer, _U32 b
 			timeout
 		);
 		if (usbRet < 0) {
-			ERR(("_mcuCommandFlashPageRead(): USB error '%s'!", usb_strerror()));
+			ERR(("_mcuCommandFlashPageRead(): USB error '%s'!", transport->strerror()));
 
 			ret = COMMON_ERROR;
 			break;
@@ -301,25 +566,26 @@ static CommonError _mcuCommandFlashPageRead(_U32 pageNumber, _U8 *buffer, _U32 b
 }
 
 
-static CommonError _mcuCommandFlashPageWrite(_U32 pageNumber, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
+static CommonError _mcuCommandFlashPageWrite(Bootloader *bootloader, _U8 command, _U16 flags, _U32 pageNumber, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 usbRet;
 		_U8  response;
 
-		usbRet = usb_control_msg(
-			privateData.deviceHandle,
-			USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-			BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE,
-			0,
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_WRITE,
+			TRANSPORT_DIRECTION_OUT,
+			command,
+			flags,
 			pageNumber,
 			buffer,
 			bufferSize,
 			timeout
 		);
 		if (usbRet < 0) {
-			ERR(("_mcuCommandFlashPageWrite(): USB error '%s'!", usb_strerror()));
+			ERR(("_mcuCommandFlashPageWrite(): USB error '%s'!", transport->strerror()));
 
 			ret = COMMON_ERROR;
 			break;
@@ -337,7 +603,7 @@ static CommonError _mcuCommandFlashPageWrite(_U32 pageNumber, _U8 *buffer, _U32
 }
 
 
-static CommonError _mcuCommandE2PromRead(_U32 offset, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
+static CommonError _mcuCommandE2PromRead(Bootloader *bootloader, _U32 offset, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
@@ -347,9 +613,10 @@ static CommonError _mcuCommandE2PromRead(_U32 offset, _U8 *buffer, _U32 bufferSi
 			_S32 usbRet;
 			_U8  response[2];
 
-			usbRet = usb_control_msg(
-				privateData.deviceHandle,
-				USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+			usbRet = _controlMsg(
+				bootloader,
+				BOOTLOADER_COMMAND_TYPE_E2PROM_READ,
+				TRANSPORT_DIRECTION_IN,
 				BOOTLOADER_COMMON_COMMAND_E2PROM_READ,
 				0,
 				offset + i,
@@ -358,7 +625,7 @@ static CommonError _mcuCommandE2PromRead(_U32 offset, _U8 *buffer, _U32 bufferSi
 				timeout
 			);
 			if (usbRet < 0) {
-				ERR(("_mcuCommandE2Prom(): USB error '%s'!", usb_strerror()));
+				ERR(("_mcuCommandE2Prom(): USB error '%s'!", transport->strerror()));
 
 				ret = COMMON_ERROR;
 				break;
@@ -379,7 +646,7 @@ static CommonError _mcuCommandE2PromRead(_U32 offset, _U8 *buffer, _U32 bufferSi
 }
 
 
-static CommonError _mcuCommandE2PromWrite(_U32 offset, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
+static CommonError _mcuCommandE2PromWrite(Bootloader *bootloader, _U32 offset, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
@@ -391,9 +658,10 @@ static CommonError _mcuCommandE2PromWrite(_U32 offset, _U8 *buffer, _U32 bufferS
 			_S32 usbRet;
 			_U8  response;
 
-			usbRet = usb_control_msg(
-				privateData.deviceHandle,
-				USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+			usbRet = _controlMsg(
+				bootloader,
+				BOOTLOADER_COMMAND_TYPE_E2PROM_WRITE,
+				TRANSPORT_DIRECTION_IN,
 				BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE,
 				buffer[i],
 				offset + i,
@@ -402,7 +670,7 @@ static CommonError _mcuCommandE2PromWrite(_U32 offset, _U8 *buffer, _U32 bufferS
 				timeout
 			);
 			if (usbRet < 0) {
-				ERR(("_mcuCommandE2PromWrite(): USB error '%s'!", usb_strerror()));
+				ERR(("_mcuCommandE2PromWrite(): USB error '%s'!", transport->strerror()));
 
 				ret = COMMON_ERROR;
 				break;
@@ -421,451 +689,1546 @@ static CommonError _mcuCommandE2PromWrite(_U32 offset, _U8 *buffer, _U32 bufferS
 }
 
 
-_S32 usbGetStringAscii(usb_dev_handle *dev, int index, char *buf, int buflen) {
-	_S32 ret = 0;
+static CommonError _mcuCommandE2PromBlockRead(Bootloader *bootloader, _U32 offset, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
 
 	do {
-		char buffer[256] = { 0 };
-		_S32 rval;
-		_S32 i;
+		_U32 i = 0;
+
+		while (i < bufferSize) {
+			_U32 blockSize = (bufferSize - i > BOOTLOADER_E2PROM_BLOCK_SIZE) ? BOOTLOADER_E2PROM_BLOCK_SIZE : bufferSize - i;
+			_S32 usbRet;
 
-		ret = usb_get_string_simple(dev, index, buf, buflen);
-		if (ret >= 0) {
-			DBG(("usbGetStringAscii(): Read by usb_get_string_simple"));
+			usbRet = _controlMsg(
+				bootloader,
+				BOOTLOADER_COMMAND_TYPE_E2PROM_READ,
+				TRANSPORT_DIRECTION_IN,
+				BOOTLOADER_COMMON_COMMAND_E2PROM_READ_BLOCK,
+				0,
+				offset + i,
+				buffer + i,
+				blockSize,
+				timeout
+			);
+			if (usbRet < 0) {
+				ERR(("_mcuCommandE2PromBlockRead(): USB error '%s'!", transport->strerror()));
 
-			break;
-		}
+				ret = COMMON_ERROR;
+				break;
+			}
 
-		ret = usb_control_msg(dev, USB_ENDPOINT_IN, USB_REQ_GET_DESCRIPTOR, (USB_DT_STRING << 8) + index, 0x0409, buffer, sizeof(buffer), 5000);
-		if (ret < 0) {
-			DBG(("usbGetStringAscii(): usb_control_msg() returned error! %d", ret));
+			if (usbRet != blockSize) {
+				ERR(("_mcuCommandE2PromBlockRead(): Bad response!, %d", usbRet));
 
-			break;
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			i += blockSize;
 		}
+	} while (0);
 
-		if (buffer[1] != USB_DT_STRING){
-			DBG(("usbGetStringAscii(): no string data! %02x", buffer[1]));
-			*buf = 0;
+	return ret;
+}
 
-			ret = 0;
-			break;
-		}
 
-		if ((_U8) buffer[0] < ret) {
-			ret = (_U8) buffer[0];
-		}
+static CommonError _mcuCommandE2PromBlockWrite(Bootloader *bootloader, _U32 offset, _U8 *buffer, _U32 bufferSize, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		_U32 i = 0;
+
+		DBG(("_mcuCommandE2PromBlockWrite(): Call for buffer: %p, bufferSize: %d", buffer, bufferSize));
+
+		while (i < bufferSize) {
+			_U32 blockSize = (bufferSize - i > BOOTLOADER_E2PROM_BLOCK_SIZE) ? BOOTLOADER_E2PROM_BLOCK_SIZE : bufferSize - i;
+			_S32 usbRet;
 
-		ret /= 2;
+			usbRet = _controlMsg(
+				bootloader,
+				BOOTLOADER_COMMAND_TYPE_E2PROM_WRITE,
+				TRANSPORT_DIRECTION_OUT,
+				BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK,
+				0,
+				offset + i,
+				buffer + i,
+				blockSize,
+				timeout
+			);
+			if (usbRet < 0) {
+				ERR(("_mcuCommandE2PromBlockWrite(): USB error '%s'!", transport->strerror()));
 
-		for (i = 1; i < rval; i++){
-			if (i > buflen) {
+				ret = COMMON_ERROR;
 				break;
 			}
 
-			buf[i - 1] = buffer[2 * i];
+			if (usbRet != blockSize) {
+				ERR(("_mcuCommandE2PromBlockWrite(): Bad response!, %d", usbRet));
 
-			if (buffer[2 * i + 1] != 0) {
-				buf[i - 1] = '?';
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
 			}
-		}
 
-		buf[i - 1] = 0;
+			i += blockSize;
+		}
 	} while (0);
 
 	return ret;
 }
 
 
-static _U8 _crc8_getForByte(_U8 byte, _U8 polynomial, _U8 start) {
-	_U8 remainder = start;
+static CommonError _mcuCommandE2PromSync(Bootloader *bootloader, _BOOL wait, _U32 *pending, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
 
-	remainder ^= byte;
+	do {
+		_S32 usbRet;
+		_U8  response[3];
+
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_E2PROM_WRITE,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_E2PROM_SYNC,
+			wait ? BOOTLOADER_COMMON_E2PROM_SYNC_FLAG_WAIT : 0,
+			0,
+			response,
+			sizeof(response),
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandE2PromSync(): USB error '%s'!", transport->strerror()));
 
-	{
-		_U8 bit;
+			ret = COMMON_ERROR;
+			break;
+		}
 
-		for (bit = 0; bit < 8; bit++) {
-			if (remainder & 0x01) {
-				remainder = (remainder >> 1) ^ polynomial;
+		if ((usbRet != sizeof(response)) || (response[0] != BOOTLOADER_COMMON_COMMAND_STATUS_OK)) {
+			ERR(("_mcuCommandE2PromSync(): Bad response!"));
 
-			} else {
-				remainder = (remainder >> 1);
-			}
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
 
+		if (pending != NULL) {
+			*pending = response[1] | (response[2] << 8);
 		}
-	}
+	} while (0);
 
-    return remainder;
+	return ret;
 }
 
 
-static _U32 _getTime(void) {
-	_U32 ret = 0;
-
-	{
-		struct timeval tv;
-
-		gettimeofday(&tv, NULL);
-
-		ret = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	}
-}
+static CommonError _mcuCommandFlashReport(Bootloader *bootloader, BootloaderFlashReport *report, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
 
+	do {
+		_S32 usbRet;
+		_U8  response[BOOTLOADER_COMMON_FLASH_REPORT_RESPONSE_SIZE];
 
-CommonError bootloader_initialize(void) {
-	CommonError ret = COMMON_NO_ERROR;
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_FLASH_REPORT,
+			0,
+			0,
+			response,
+			sizeof(response),
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandFlashReport(): USB error '%s'!", transport->strerror()));
 
-	ASSERT(! initialized);
+			ret = COMMON_ERROR;
+			break;
+		}
 
-	{
-		usb_init();
+		if ((usbRet != sizeof(response)) || (response[0] != BOOTLOADER_COMMON_COMMAND_STATUS_OK)) {
+			ERR(("_mcuCommandFlashReport(): Bad response!"));
 
-		privateData.deviceHandle  = NULL;
-		privateData.mcuParameters = NULL;
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
 
-		initialized = TRUE;
-	}
+		report->pagesWritten   = response[1] | (response[2] << 8);
+		report->pagesUnchanged = response[3] | (response[4] << 8);
+		report->pagesErased    = response[5] | (response[6] << 8);
+		report->erasesSkipped  = response[7] | (response[8] << 8);
+	} while (0);
 
 	return ret;
 }
 
 
-CommonError bootloader_terminate(void) {
-	CommonError ret = COMMON_NO_ERROR;
-
-	ASSERT(initialized);
-
-	{
-		initialized = FALSE;
-	}
-
-	return ret;
+// Multi-byte protocol fields are sent LSB first
+static _U32 _getU32(const _U8 *buffer) {
+	return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((_U32) buffer[3] << 24);
 }
 
 
-CommonError bootloader_connect(BootloaderTargetInformation *targetInformation, _U32 timeout) {
+static CommonError _mcuCommandGetStats(Bootloader *bootloader, _BOOL clear, BootloaderDeviceStatistics *statistics, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
-	ASSERT(initialized);
-	ASSERT(targetInformation != NULL);
-
-	{
-		usb_dev_handle *deviceHandle = NULL;
+	do {
+		_S32 usbRet;
+		_U8  response[BOOTLOADER_COMMON_STATS_RESPONSE_SIZE];
+		_U32 spmTicks;
+		_U32 spmTimerFrequency;
+		_U32 bootCheckTicks;
+
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_GET_STATS,
+			clear ? BOOTLOADER_COMMON_STATS_FLAG_CLEAR : 0,
+			0,
+			response,
+			sizeof(response),
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandGetStats(): USB error '%s'!", transport->strerror()));
 
-		do {
-			_U32  startTime = _getTime();
-			_BOOL firstLoop = FALSE;
+			ret = COMMON_ERROR;
+			break;
+		}
 
-			do {
-				struct usb_device *dev;
+		if ((usbRet != sizeof(response)) || (response[0] != BOOTLOADER_COMMON_COMMAND_STATUS_OK)) {
+			ERR(("_mcuCommandGetStats(): Bad response!"));
 
-				_S32 libUsbRet;
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
 
-				if (timeout != BOOTLOADER_TIMEOUT_INFINITY) {
-					if (_getTime() - startTime >= timeout) {
-						ret = COMMON_ERROR_TIMEOUT;
+		statistics->setupRequests  = _getU32(response + 1);
+		statistics->bytesIn        = _getU32(response + 5);
+		statistics->bytesOut       = _getU32(response + 9);
+		statistics->pagesErased    = response[13] | (response[14] << 8);
+		statistics->pagesWritten   = response[15] | (response[16] << 8);
+		spmTicks                   = _getU32(response + 17);
+		spmTimerFrequency          = _getU32(response + 21);
+		statistics->watchdogResets = response[25] | (response[26] << 8);
+		bootCheckTicks             = response[27] | (response[28] << 8);
+
+		statistics->spmBusyTime   = (spmTimerFrequency > 0) ? (_U64) spmTicks * 1000000 / spmTimerFrequency : 0;
+		statistics->bootCheckTime = (spmTimerFrequency > 0) ? (_U64) bootCheckTicks * 1000000 / spmTimerFrequency : 0;
+	} while (0);
 
-						break;
-					}
-				}
+	return ret;
+}
 
-				{
-					_S32 findRet = 0;
 
-					findRet |= usb_find_busses();
-					findRet |= usb_find_devices();
-					if (! firstLoop && (findRet == 0)) {
-						usleep(BOOTLOADER_CHECK_DEVICES_INTERVAL * 1000);
+static CommonError _mcuCommandFlashCrc(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 crcStart, _U8 *crc, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
 
-						continue;
-					}
-				}
+	do {
+		_S32 usbRet;
+		_U8  response[2];
+
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_CHECKSUM,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_FLASH_CRC,
+			(crcStart << 8) | pagesCount,
+			firstPage,
+			response,
+			sizeof(response),
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandFlashCrc(): USB error '%s'!", transport->strerror()));
+
+			ret = COMMON_ERROR;
+			break;
+		}
+
+		if ((usbRet != 2) || (response[0] != BOOTLOADER_COMMON_COMMAND_STATUS_OK)) {
+			ERR(("_mcuCommandFlashCrc(): Bad response!, %d", usbRet));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		*crc = response[1];
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _mcuCommandFlashPagesCrc(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U16 *pagesCrc, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		_U8  response[BOOTLOADER_PAGES_CRC_BLOCK_SIZE * 2];
+		_S32 usbRet;
+		_U32 i;
+
+		usbRet = _controlMsg(
+			bootloader,
+			BOOTLOADER_COMMAND_TYPE_CHECKSUM,
+			TRANSPORT_DIRECTION_IN,
+			BOOTLOADER_COMMON_COMMAND_FLASH_PAGES_CRC,
+			0,
+			firstPage,
+			response,
+			pagesCount * 2,
+			timeout
+		);
+		if (usbRet < 0) {
+			ERR(("_mcuCommandFlashPagesCrc(): USB error '%s'!", transport->strerror()));
+
+			ret = COMMON_ERROR;
+			break;
+		}
 
-				firstLoop = FALSE;
+		if (usbRet != pagesCount * 2) {
+			ERR(("_mcuCommandFlashPagesCrc(): Bad response!, %d", usbRet));
 
-				// iterate all buses to find bootloader
-				{
-					struct usb_bus *bus = usb_get_busses();
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
 
-					DBG(("bootloader_connect(): bus: %p", bus));
+		for (i = 0; i < pagesCount; i++) {
+			pagesCrc[i] = response[2 * i] | (response[2 * i + 1] << 8);
+		}
+	} while (0);
 
-					while (bus != NULL) {
-						usb_dev_handle *tmpHandle = NULL;
+	return ret;
+}
 
-						dev = bus->devices;
 
-						while (dev != NULL) {
-							DBG(("bootloader_connect(): Found device with PID: %04x VID: %04x", dev->descriptor.idProduct, dev->descriptor.idVendor));
+// Runs from transport thread when queued transfer is finished or could not be submitted at all
+static void _writeQueueTransferDone(WriteQueueSlot *slot, BootloaderCommandType type, _S32 result, _S32 expected, CommonError *error) {
+	BootloaderWriteQueue *queue = slot->queue;
+	_U64                  now   = _getTimeUs();
 
-							if (
-								(dev->descriptor.idVendor  == idVendor) &&
-								(dev->descriptor.idProduct == idProduct)
-							) {
-								DBG(("bootloader_connect(): Got device with proper PID: %04x, VID: %04x!", dev->descriptor.idProduct, dev->descriptor.idVendor));
+	pthread_mutex_lock(&queue->mutex);
 
-								do {
-									tmpHandle = usb_open(dev);
-									if (tmpHandle == NULL) {
-										REPORT(("Unable to open device with PID: %04x VID: %04x", idProduct, idVendor));
+	if (type != BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED) {
+		// Control transfers are done one by one, queued one starts when the previous one finishes
+		_U64 startTime = (slot->submitTime > queue->lastCompletion) ? slot->submitTime : queue->lastCompletion;
 
-										break;
-									}
+		_statisticsAdd(queue->bootloader, type, result, now - startTime);
 
-									if (dev->descriptor.iManufacturer > 0) {
-										char vendor[256] = { 0 };
+		queue->lastCompletion = now;
+	}
 
-										libUsbRet = usbGetStringAscii(tmpHandle, dev->descriptor.iManufacturer, vendor, sizeof(vendor));
-										if (libUsbRet >= 0) {
-											DBG(("bootloader_connect(): vendor: '%s'", vendor));
+	if (result < 0) {
+		ERR(("_writeQueueTransferDone(): Transfer of pages %d - %d failed! (%d)", slot->write.firstPage, slot->write.firstPage + slot->write.pagesCount - 1, result));
 
-											if (strcmp(vendor, vendorName) == 0) {
-												DBG(("bootloader_connect(): Found device with proper vendor!"));
+		*error = COMMON_ERROR;
 
-											} else {
-												break;
-											}
+	} else if (result != expected) {
+		ERR(("_writeQueueTransferDone(): Bad response!, %d", result));
 
-										} else {
-											DBG(("bootloader_connect(): Error reading vendor!"));
-										}
-									}
+		*error = COMMON_ERROR_BAD_PARAMETER;
+	}
 
-									if (dev->descriptor.iProduct > 0) {
-										char product[256] = { 0 };
+	slot->transfersLeft--;
+	queue->transfersPending--;
 
-										libUsbRet = usbGetStringAscii(tmpHandle, dev->descriptor.iProduct, product, sizeof(product));
-										if (libUsbRet >= 0) {
-											DBG(("bootloader_connect(): product: '%s'", product));
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
 
-											if (strcmp(product, deviceName) == 0) {
-												DBG(("bootloader_connect(): Found device with proper product name!"));
 
-												deviceHandle = tmpHandle;
-												break;
+static void _writeQueueWriteDone(_S32 result, void *context) {
+	WriteQueueSlot *slot = context;
 
-											} else {
-												break;
-											}
+	_writeQueueTransferDone(slot, BOOTLOADER_COMMAND_TYPE_WRITE, result, slot->write.pagesCount * slot->queue->bootloader->mcuParameters->flash.pageSize, &slot->write.result);
+}
 
-										} else {
-											DBG(("bootloader_connect(): Error reading product!"));
-										}
-									}
-								} while (0);
 
-								if (deviceHandle == NULL) {
-									if (tmpHandle != NULL) {
-										DBG(("bootloader_connect(): Closing device!"));
+static void _writeQueueChecksumDone(_S32 result, void *context) {
+	WriteQueueSlot *slot = context;
+	_U32            i;
 
-										usb_close(tmpHandle);
+	// Slot is not reaped before the last transfer completes, checksums are set before that
+	if (result == (_S32) slot->write.pagesCount * 2) {
+		for (i = 0; i < slot->write.pagesCount; i++) {
+			slot->write.pagesCrc[i] = slot->crcResponse[2 * i] | (slot->crcResponse[2 * i + 1] << 8);
+		}
+	}
 
-										tmpHandle = NULL;
-									}
+	_writeQueueTransferDone(slot, BOOTLOADER_COMMAND_TYPE_CHECKSUM, result, slot->write.pagesCount * 2, &slot->write.checksumResult);
+}
 
-								} else {
-									break;
-								}
-							}
 
-							dev = dev->next;
-						}
+// Transfer queued behind others has to wait for them, timeout starts on submission
+static _U32 _writeQueueTimeout(BootloaderWriteQueue *queue, _U32 timeout, _U32 transfersAhead) {
+	if ((timeout == BOOTLOADER_TIMEOUT_INFINITY) || (timeout > BOOTLOADER_TIMEOUT_INFINITY / (transfersAhead + 1))) {
+		return BOOTLOADER_TIMEOUT_INFINITY;
+	}
 
-						if (deviceHandle != NULL) {
-							break;
-						}
+	return timeout * (transfersAhead + 1);
+}
 
-						bus = bus->next;
-					}
-				}
 
-				if (deviceHandle != NULL) {
-					break;
-				}
-			} while (1);
+static _U32 _getTime(void) {
+	_U32 ret = 0;
 
-			if (ret != COMMON_NO_ERROR) {
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+
+		ret = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+
+	return ret;
+}
+
+
+static _BOOL _versionAtLeast(McuInformation *info, _U8 major, _U8 minor) {
+	if (info->bootloaderVersion.major != major) {
+		return info->bootloaderVersion.major > major;
+	}
+
+	return info->bootloaderVersion.minor >= minor;
+}
+
+
+// Capabilities of bootloaders released before HELLO
+static _U16 _capabilitiesFromVersion(McuInformation *info) {
+	_U16 ret = 0;
+
+	if (_versionAtLeast(info, 0, 5)) {
+		ret |= BOOTLOADER_COMMON_CAPABILITY_E2PROM_BLOCK;
+	}
+
+	if (_versionAtLeast(info, 0, 6)) {
+		ret |= BOOTLOADER_COMMON_CAPABILITY_FLASH_CRC;
+	}
+
+	if (_versionAtLeast(info, 0, 7)) {
+		ret |= BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_WRITE;
+	}
+
+	if (_versionAtLeast(info, 0, 8)) {
+		ret |= BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES_CRC;
+	}
+
+	if (_versionAtLeast(info, 0, 9)) {
+		ret |= BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES;
+	}
+
+	if (_versionAtLeast(info, 0, 10)) {
+		ret |= BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_PAGES;
+	}
+
+	return ret;
+}
+
+
+static _BOOL _bootloaderHasCapability(Bootloader *bootloader, _U16 capability) {
+	return (bootloader->mcuInformation.capabilities & capability) == capability;
+}
+
+
+static _BOOL _informationCacheGet(const char *deviceId, McuInformationCacheEntry *cached) {
+	_BOOL ret = FALSE;
+	_U32  i;
+
+	if (deviceId == NULL) {
+		return FALSE;
+	}
+
+	pthread_mutex_lock(&informationCacheMutex);
+	{
+		for (i = 0; i < BOOTLOADER_INFORMATION_CACHE_SIZE; i++) {
+			if (informationCache[i].valid && (strcmp(informationCache[i].deviceId.name, deviceId) == 0)) {
+				*cached = informationCache[i];
+
+				ret = TRUE;
 				break;
 			}
+		}
+	}
+	pthread_mutex_unlock(&informationCacheMutex);
+
+	return ret;
+}
+
+
+static void _informationCachePut(const char *deviceId, Bootloader *bootloader, BootloaderTargetInformation *target) {
+	McuInformationCacheEntry *entry = NULL;
+	_U32                      i;
 
-			if (deviceHandle == NULL) {
-				ret = COMMON_ERROR_NO_DEVICE;
+	if (deviceId == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&informationCacheMutex);
+	{
+		for (i = 0; i < BOOTLOADER_INFORMATION_CACHE_SIZE; i++) {
+			if (informationCache[i].valid && (strcmp(informationCache[i].deviceId.name, deviceId) == 0)) {
+				entry = &informationCache[i];
 				break;
 			}
+		}
 
-			privateData.deviceHandle = deviceHandle;
+		// Oldest entry is replaced
+		if (entry == NULL) {
+			entry = &informationCache[informationCacheNext];
 
-			{
-				McuInformation info = { 0 };
+			informationCacheNext = (informationCacheNext + 1) % BOOTLOADER_INFORMATION_CACHE_SIZE;
+		}
 
-				ret = _mcuCommandConnect(timeout - (_getTime() - startTime));
-				if (ret != COMMON_NO_ERROR) {
-					ERR(("bootloader_connect(): Unable to establish connection with bootloader!"));
+		memset(entry, 0, sizeof(*entry));
 
-					break;
-				}
+		strncpy(entry->deviceId.name, deviceId, sizeof(entry->deviceId.name) - 1);
 
-				ret = _mcuCommandGetInfo(&info, timeout - (_getTime() - startTime));
-				if (ret != COMMON_NO_ERROR) {
-					ERR(("bootloader_connect(): Unable to retrieve bootloader and MCU parameters!"));
+		entry->info          = bootloader->mcuInformation;
+		entry->mcuParameters = bootloader->mcuParameters;
+		entry->target        = *target;
+		entry->valid         = TRUE;
+	}
+	pthread_mutex_unlock(&informationCacheMutex);
+}
 
-					break;
-				}
 
-				{
-					_U32 i;
+static void _informationCacheDrop(const char *deviceId) {
+	_U32 i;
 
-					for (i = 0; i < sizeof(mcu) / sizeof(*mcu); i++) {
-						if (
-							(mcu[i].id.byte1 == info.signature.byte1) &&
-							(mcu[i].id.byte2 == info.signature.byte2) &&
-							(mcu[i].id.byte3 == info.signature.byte3)
-						) {
-							DBG(("bootloader_connect(): Found mcu parameters !"));
+	if (deviceId == NULL) {
+		return;
+	}
 
-							privateData.mcuParameters = &mcu[i];
-							break;
-						}
-					}
+	pthread_mutex_lock(&informationCacheMutex);
+	{
+		for (i = 0; i < BOOTLOADER_INFORMATION_CACHE_SIZE; i++) {
+			if (informationCache[i].valid && (strcmp(informationCache[i].deviceId.name, deviceId) == 0)) {
+				informationCache[i].valid = FALSE;
+			}
+		}
+	}
+	pthread_mutex_unlock(&informationCacheMutex);
+}
 
-					if (privateData.mcuParameters == NULL) {
-						ERR(("bootloader_connect(): Not supported MCU! (%02x%02x%02x)", info.signature.byte1, info.signature.byte2, info.signature.byte3));
 
-						ret = COMMON_ERROR_NO_DEVICE;
-						break;
-					}
+static _BOOL _informationSameDevice(McuInformation *info, McuInformation *other) {
+	return
+		(info->bootloaderVersion.major == other->bootloaderVersion.major) &&
+		(info->bootloaderVersion.minor == other->bootloaderVersion.minor) &&
+		(info->signature.byte1         == other->signature.byte1) &&
+		(info->signature.byte2         == other->signature.byte2) &&
+		(info->signature.byte3         == other->signature.byte3) &&
+		(info->bootloaderSizeInPages   == other->bootloaderSizeInPages) &&
+		(info->capabilities            == other->capabilities);
+}
+
+
+static CommonError _resolveTarget(Bootloader *bootloader, BootloaderTargetInformation *target) {
+	CommonError     ret  = COMMON_NO_ERROR;
+	McuInformation *info = &bootloader->mcuInformation;
+
+	do {
+		_U32 i;
+
+		for (i = 0; i < sizeof(mcu) / sizeof(*mcu); i++) {
+			if (
+				(mcu[i].id.byte1 == info->signature.byte1) &&
+				(mcu[i].id.byte2 == info->signature.byte2) &&
+				(mcu[i].id.byte3 == info->signature.byte3)
+			) {
+				DBG(("_resolveTarget(): Found mcu parameters !"));
+
+				bootloader->mcuParameters = &mcu[i];
+				break;
+			}
+		}
+
+		if (bootloader->mcuParameters == NULL) {
+			ERR(("_resolveTarget(): Not supported MCU! (%02x%02x%02x)", info->signature.byte1, info->signature.byte2, info->signature.byte3));
+
+			ret = COMMON_ERROR_NO_DEVICE;
+			break;
+		}
+
+		target->bootloader.versionMajor = info->bootloaderVersion.major;
+		target->bootloader.versionMinor = info->bootloaderVersion.minor;
+		target->bootloader.capabilities = info->capabilities;
+
+		target->flash.pageSize   = bootloader->mcuParameters->flash.pageSize;
+		target->flash.pagesCount = (bootloader->mcuParameters->flash.size / bootloader->mcuParameters->flash.pageSize) - info->bootloaderSizeInPages;
+
+		target->e2prom.size = bootloader->mcuParameters->e2prom.size;
+
+		target->mcu.name = bootloader->mcuParameters->name;
+	} while (0);
+
+	return ret;
+}
+
+
+/*
+ * Single HELLO round trip on current bootloaders. Older ones need CONNECT and
+ * GET_INFO, the latter is skipped if the device was already seen under the same id.
+ * Target information resolved from the handshake is cached along with it.
+ */
+static CommonError _handshake(Bootloader *bootloader, const char *deviceId, BootloaderTargetInformation *target, _U32 startTime, _U32 timeout) {
+	CommonError     ret  = COMMON_NO_ERROR;
+	McuInformation *info = &bootloader->mcuInformation;
+
+	do {
+		McuInformationCacheEntry cached   = { 0 };
+		_BOOL                    isCached = _informationCacheGet(deviceId, &cached);
+
+		do {
+			if (! isCached || cached.info.hello) {
+				ret = _mcuCommandHello(bootloader, info, timeout - (_getTime() - startTime));
+				if (ret != COMMON_ERROR_NOT_SUPPORTED) {
+					break;
 				}
 
-				privateData.bootloaderSectionSize = info.bootloaderSizeInPages * privateData.mcuParameters->flash.pageSize;
+				// Device under this id was replaced by an older one
+				isCached = FALSE;
+			}
+
+			ret = _mcuCommandConnect(bootloader, timeout - (_getTime() - startTime));
+			if (ret != COMMON_NO_ERROR) {
+				ERR(("_handshake(): Unable to establish connection with bootloader!"));
 
-//				DBG(("Found bootloader in revision: %d.%d on MCU: '%s'", info.bootloaderVersion.major, info.bootloaderVersion.minor, privateData.mcuParameters->name));
+				break;
+			}
 
-				targetInformation->bootloader.versionMajor = info.bootloaderVersion.major;
-				targetInformation->bootloader.versionMinor = info.bootloaderVersion.minor;
+			if (isCached) {
+				DBG(("_handshake(): Using cached information of device %s", deviceId));
 
-				targetInformation->flash.pageSize   = privateData.mcuParameters->flash.pageSize;
-				targetInformation->flash.pagesCount = (privateData.mcuParameters->flash.size / privateData.mcuParameters->flash.pageSize) - info.bootloaderSizeInPages;
+				*info = cached.info;
+				break;
+			}
 
-				targetInformation->e2prom.size = privateData.mcuParameters->e2prom.size;
+			ret = _mcuCommandGetInfo(bootloader, info, timeout - (_getTime() - startTime));
+			if (ret != COMMON_NO_ERROR) {
+				ERR(("_handshake(): Unable to retrieve bootloader and MCU parameters!"));
 
-				targetInformation->mcu.name = privateData.mcuParameters->name;
+				break;
 			}
+
+			info->capabilities = _capabilitiesFromVersion(info);
+			info->hello        = FALSE;
 		} while (0);
 
 		if (ret != COMMON_NO_ERROR) {
-			if (deviceHandle != NULL) {
-				usb_close(deviceHandle);
-			}
+			break;
+		}
+
+		if (isCached && _informationSameDevice(info, &cached.info)) {
+			bootloader->mcuParameters = cached.mcuParameters;
 
-			privateData.deviceHandle = NULL;
+			*target = cached.target;
+			break;
 		}
+
+		ret = _resolveTarget(bootloader, target);
+	} while (0);
+
+	if (ret == COMMON_NO_ERROR) {
+		_informationCachePut(deviceId, bootloader, target);
+
+	} else {
+		_informationCacheDrop(deviceId);
 	}
 
 	return ret;
 }
 
 
-CommonError bootloader_disconnect(void) {
+CommonError bootloader_initialize(BootloaderTransport transportType, const char *transportParameter) {
 	CommonError ret = COMMON_NO_ERROR;
 
-	ASSERT(initialized);
+	ASSERT(! initialized);
 
-	{
-		if (privateData.deviceHandle) {
-			usb_close(privateData.deviceHandle);
+	do {
+		if (transportType == BOOTLOADER_TRANSPORT_SIMULATOR) {
+			transport = &transportSimulator;
 
-			privateData.deviceHandle = NULL;
+		} else {
+			transport = &transportLibusb;
 		}
-	}
+
+		ret = transport->initialize(transportParameter);
+		if (ret != COMMON_NO_ERROR) {
+			ERR(("bootloader_initialize(): Unable to initialize '%s' transport!", transport->name));
+
+			break;
+		}
+
+		initialized = TRUE;
+	} while (0);
 
 	return ret;
 }
 
 
-CommonError bootloader_reset(_U32 timeout) {
+CommonError bootloader_terminate(void) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	ASSERT(initialized);
 
 	{
-		DBG(("bootloader_reset(): Reset"));
+		ret = transport->terminate();
 
-		ret = _mcuCommandReboot(timeout);
+		initialized = FALSE;
 	}
 
 	return ret;
 }
 
 
-CommonError bootloader_flashPageErase(_U32 pageAddress, _U32 timeout) {
+CommonError bootloader_enumerate(BootloaderDeviceId *devices, _U32 devicesMax, _U32 *devicesCount) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	ASSERT(initialized);
+	ASSERT(devicesCount != NULL);
 
 	{
-		DBG(("bootloader_flashPageErase(): Erasing page number: %d", pageAddress));
+		TransportDeviceId *ids = NULL;
+
+		*devicesCount = 0;
+
+		do {
+			_U32 i;
+
+			ids = malloc(devicesMax * sizeof(TransportDeviceId));
+			if (ids == NULL) {
+				ERR(("bootloader_enumerate(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			ret = transport->enumerate(ids, devicesMax, devicesCount);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			for (i = 0; i < *devicesCount; i++) {
+				strncpy(devices[i].name, ids[i].name, sizeof(devices[i].name) - 1);
 
-		ret = _mcuCommandFlashPageErase(pageAddress, timeout);
+				devices[i].name[sizeof(devices[i].name) - 1] = '\0';
+			}
+		} while (0);
+
+		if (ids != NULL) {
+			free(ids);
+		}
 	}
 
 	return ret;
 }
 
 
-CommonError bootloader_flashPageRead(_U32 pageAddress, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferReadSize) {
+CommonError bootloader_connect(Bootloader **bootloader, const char *deviceId, BootloaderTargetInformation *targetInformation, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+	ASSERT(targetInformation != NULL);
 
 	{
-		DBG(("bootloader_flashPageRead(): Reading from page %d", pageAddress));
+		Bootloader *context = NULL;
+
+		do {
+			_U32 startTime = _getTime();
+
+			context = malloc(sizeof(Bootloader));
+			if (context == NULL) {
+				ERR(("bootloader_connect(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
 
-		ret = _mcuCommandFlashPageRead(pageAddress, pageBuffer, pageBufferSize, timeout);
+			memset(context, 0, sizeof(Bootloader));
+
+			pthread_mutex_init(&context->statisticsMutex, NULL);
+
+			context->statisticsStart = _getTimeUs();
+
+			ret = transport->open(&context->device, deviceId, timeout);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			ret = _handshake(context, deviceId, targetInformation, startTime, timeout);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			context->bootloaderSectionSize = context->mcuInformation.bootloaderSizeInPages * context->mcuParameters->flash.pageSize;
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (context != NULL) {
+				if (context->device != NULL) {
+					transport->close(context->device);
+				}
+
+				_statisticsFree(context);
+
+				pthread_mutex_destroy(&context->statisticsMutex);
+
+				free(context);
+
+				context = NULL;
+			}
+		}
+
+		*bootloader = context;
 	}
 
 	return ret;
 }
 
 
-CommonError bootloader_flashPageWrite(_U32 pageAddress, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferWritten) {
+CommonError bootloader_disconnect(Bootloader *bootloader) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	ASSERT(initialized);
 
 	{
-		DBG(("bootloader_flashPageWrite(): Writing page number: %d", pageAddress));
+		if (bootloader != NULL) {
+			if (bootloader->device != NULL) {
+				transport->close(bootloader->device);
+			}
 
-		ret = _mcuCommandFlashPageWrite(pageAddress, pageBuffer, pageBufferSize, timeout);
+			_statisticsFree(bootloader);
+
+			pthread_mutex_destroy(&bootloader->statisticsMutex);
+
+			free(bootloader);
+		}
 	}
 
 	return ret;
 }
 
 
-CommonError bootloader_e2promRead(_U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferReadSize) {
+CommonError bootloader_reset(Bootloader *bootloader, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
 
 	{
-		DBG(("bootloader_e2promRead(): Reading e2prom from: %d, size: %d", address, e2promBufferSize));
+		DBG(("bootloader_reset(): Reset"));
 
-		ret = _mcuCommandE2PromRead(address, e2promBuffer, e2promBufferSize, timeout);
+		ret = _mcuCommandReboot(bootloader, timeout);
 	}
 
 	return ret;
 }
 
 
-CommonError bootloader_e2promWrite(_U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferWritten) {
+CommonError bootloader_flashPageErase(Bootloader *bootloader, _U32 pageAddress, _U32 timeout) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
 
 	{
-		DBG(("bootloader_e2promWrite(): Writing e2prom at: %d, size: %d", address, e2promBufferSize));
+		DBG(("bootloader_flashPageErase(): Erasing page number: %d", pageAddress));
 
-		ret = _mcuCommandE2PromWrite(address, e2promBuffer, e2promBufferSize, timeout);
+		ret = _mcuCommandFlashPageErase(bootloader, pageAddress, timeout);
 	}
 
 	return ret;
 }
+
+
+CommonError bootloader_flashPagesErase(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_flashPagesErase(): Erasing pages: %d - %d", firstPage, firstPage + pagesCount - 1));
+
+		if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_PAGES)) {
+			if (timeout != BOOTLOADER_TIMEOUT_INFINITY) {
+				timeout += pagesCount * BOOTLOADER_PAGE_ERASE_TIME_MS;
+			}
+
+			ret = _mcuCommandFlashPagesErase(bootloader, firstPage, pagesCount, timeout);
+
+		} else {
+			_U32 i;
+
+			for (i = 0; i < pagesCount; i++) {
+				ret = _mcuCommandFlashPageErase(bootloader, firstPage + i, timeout);
+				if (ret != COMMON_NO_ERROR) {
+					break;
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_flashPageRead(Bootloader *bootloader, _U32 pageAddress, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferReadSize) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_flashPageRead(): Reading from page %d", pageAddress));
+
+		ret = _mcuCommandFlashPageRead(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE, pageAddress, pageBuffer, pageBufferSize, timeout);
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_flashPageWrite(Bootloader *bootloader, _U32 pageAddress, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferWritten) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_flashPageWrite(): Writing page number: %d", pageAddress));
+
+		ret = _mcuCommandFlashPageWrite(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE, 0, pageAddress, pageBuffer, pageBufferSize, timeout);
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_flashPageEraseWrite(Bootloader *bootloader, _U32 pageNumber, _U8 *pageBuffer, _U32 pageBufferSize, _U32 timeout, _U32 *pageBufferWritten) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_flashPageEraseWrite(): Erasing and writing page number: %d", pageNumber));
+
+		if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_WRITE)) {
+			ret = _mcuCommandFlashPageWrite(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE, 0, pageNumber, pageBuffer, pageBufferSize, timeout);
+
+		} else {
+			ret = _mcuCommandFlashPageErase(bootloader, pageNumber, timeout);
+			if (ret == COMMON_NO_ERROR) {
+				ret = _mcuCommandFlashPageWrite(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE, 0, pageNumber, pageBuffer, pageBufferSize, timeout);
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_flashPagesRead(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 *buffer, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		_U32 pageSize = bootloader->mcuParameters->flash.pageSize;
+		_U32 i        = 0;
+
+		DBG(("bootloader_flashPagesRead(): Reading pages: %d - %d", firstPage, firstPage + pagesCount - 1));
+
+		while (i < pagesCount) {
+			if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES)) {
+				_U32 blockSize = (pagesCount - i > BOOTLOADER_PAGES_PER_TRANSFER) ? BOOTLOADER_PAGES_PER_TRANSFER : pagesCount - i;
+
+				ret = _mcuCommandFlashPageRead(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGES, firstPage + i, buffer + i * pageSize, blockSize * pageSize, timeout);
+
+				i += blockSize;
+
+			} else {
+				ret = _mcuCommandFlashPageRead(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE, firstPage + i, buffer + i * pageSize, pageSize, timeout);
+
+				i += 1;
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_flashPagesWrite(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 *buffer, _BOOL erase, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		_U32 pageSize = bootloader->mcuParameters->flash.pageSize;
+		_U32 i        = 0;
+
+		DBG(("bootloader_flashPagesWrite(): Writing pages: %d - %d", firstPage, firstPage + pagesCount - 1));
+
+		while (i < pagesCount) {
+			if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES)) {
+				_U32 blockSize = (pagesCount - i > BOOTLOADER_PAGES_PER_TRANSFER) ? BOOTLOADER_PAGES_PER_TRANSFER : pagesCount - i;
+
+				_U16 flags     = erase ? BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE : 0;
+
+				// Device skips pages it already holds
+				if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_COMPARE)) {
+					flags |= BOOTLOADER_COMMON_FLASH_WRITE_FLAG_COMPARE;
+				}
+
+				ret = _mcuCommandFlashPageWrite(bootloader, 
+					BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES, flags,
+					firstPage + i, buffer + i * pageSize, blockSize * pageSize, timeout
+				);
+
+				i += blockSize;
+
+			} else if (erase && _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_WRITE)) {
+				ret = _mcuCommandFlashPageWrite(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE, 0, firstPage + i, buffer + i * pageSize, pageSize, timeout);
+
+				i += 1;
+
+			} else {
+				if (erase) {
+					ret = _mcuCommandFlashPageErase(bootloader, firstPage + i, timeout);
+					if (ret != COMMON_NO_ERROR) {
+						break;
+					}
+				}
+
+				ret = _mcuCommandFlashPageWrite(bootloader, BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE, 0, firstPage + i, buffer + i * pageSize, pageSize, timeout);
+
+				i += 1;
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_flashCrc(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U8 crcStart, _U8 *crc, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	do {
+		DBG(("bootloader_flashCrc(): Computing crc of pages: %d - %d", firstPage, firstPage + pagesCount - 1));
+
+		if (! _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_CRC)) {
+			ret = COMMON_ERROR_NOT_SUPPORTED;
+			break;
+		}
+
+		// Pages count is transferred on 8 bits
+		if (pagesCount > 0xff) {
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		ret = _mcuCommandFlashCrc(bootloader, firstPage, pagesCount, crcStart, crc, timeout);
+	} while (0);
+
+	return ret;
+}
+
+
+CommonError bootloader_flashPagesCrc(Bootloader *bootloader, _U32 firstPage, _U32 pagesCount, _U16 *pagesCrc, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	do {
+		_U32 i = 0;
+
+		DBG(("bootloader_flashPagesCrc(): Reading checksums of pages: %d - %d", firstPage, firstPage + pagesCount - 1));
+
+		if (! _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES_CRC)) {
+			ret = COMMON_ERROR_NOT_SUPPORTED;
+			break;
+		}
+
+		while (i < pagesCount) {
+			_U32 blockSize = (pagesCount - i > BOOTLOADER_PAGES_CRC_BLOCK_SIZE) ? BOOTLOADER_PAGES_CRC_BLOCK_SIZE : pagesCount - i;
+
+			ret = _mcuCommandFlashPagesCrc(bootloader, firstPage + i, blockSize, pagesCrc + i, timeout);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			i += blockSize;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+CommonError bootloader_writeQueueOpen(Bootloader *bootloader, _U32 depth, _BOOL checksum, BootloaderWriteQueue **queue) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+	ASSERT(depth > 0);
+	ASSERT(queue != NULL);
+
+	{
+		BootloaderWriteQueue *context = NULL;
+
+		do {
+			if (transport->controlMsgSubmit == NULL) {
+				ret = COMMON_ERROR_NOT_SUPPORTED;
+				break;
+			}
+
+			if (! _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES)) {
+				ret = COMMON_ERROR_NOT_SUPPORTED;
+				break;
+			}
+
+			if (checksum && ! _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES_CRC)) {
+				ret = COMMON_ERROR_NOT_SUPPORTED;
+				break;
+			}
+
+			context = calloc(1, sizeof(BootloaderWriteQueue));
+			if (context != NULL) {
+				context->slots = calloc(depth, sizeof(WriteQueueSlot));
+			}
+
+			if ((context == NULL) || (context->slots == NULL)) {
+				ERR(("bootloader_writeQueueOpen(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			context->bootloader = bootloader;
+			context->depth      = depth;
+			context->checksum   = checksum;
+
+			pthread_mutex_init(&context->mutex, NULL);
+			pthread_cond_init(&context->cond, NULL);
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (context != NULL) {
+				if (context->slots != NULL) {
+					free(context->slots);
+				}
+
+				free(context);
+
+				context = NULL;
+			}
+		}
+
+		*queue = context;
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_writeQueueSubmit(BootloaderWriteQueue *queue, _U32 firstPage, _U32 pagesCount, _U8 *buffer, _BOOL erase, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(queue != NULL);
+	ASSERT((pagesCount > 0) && (pagesCount <= BOOTLOADER_WRITE_QUEUE_PAGES_MAX));
+
+	{
+		Bootloader     *bootloader     = queue->bootloader;
+		WriteQueueSlot *slot           = NULL;
+		_U32            transfersAhead = 0;
+		_U16            flags          = erase ? BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE : 0;
+
+		DBG(("bootloader_writeQueueSubmit(): Queueing pages: %d - %d", firstPage, firstPage + pagesCount - 1));
+
+		// Device skips pages it already holds
+		if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_COMPARE)) {
+			flags |= BOOTLOADER_COMMON_FLASH_WRITE_FLAG_COMPARE;
+		}
+
+		pthread_mutex_lock(&queue->mutex);
+
+		if (queue->count < queue->depth) {
+			slot = &queue->slots[(queue->head + queue->count) % queue->depth];
+
+			memset(slot, 0, sizeof(*slot));
+
+			slot->queue                = queue;
+			slot->write.firstPage      = firstPage;
+			slot->write.pagesCount     = pagesCount;
+			slot->write.result         = COMMON_NO_ERROR;
+			slot->write.checksumResult = queue->checksum ? COMMON_NO_ERROR : COMMON_ERROR_NOT_SUPPORTED;
+			slot->transfersLeft        = queue->checksum ? 2 : 1;
+			slot->submitTime           = _getTimeUs();
+
+			transfersAhead = queue->transfersPending;
+
+			queue->transfersPending += slot->transfersLeft;
+			queue->count++;
+		}
+
+		pthread_mutex_unlock(&queue->mutex);
+
+		// Completion may run before submission returns, queue is not locked here
+		do {
+			if (slot == NULL) {
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			ret = transport->controlMsgSubmit(
+				bootloader->device,
+				TRANSPORT_DIRECTION_OUT,
+				BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES,
+				flags,
+				firstPage,
+				buffer,
+				pagesCount * bootloader->mcuParameters->flash.pageSize,
+				_writeQueueTimeout(queue, timeout, transfersAhead),
+				_writeQueueWriteDone,
+				slot
+			);
+			if (ret != COMMON_NO_ERROR) {
+				ERR(("bootloader_writeQueueSubmit(): USB error '%s'!", transport->strerror()));
+
+				_writeQueueTransferDone(slot, BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED, -1, 0, &slot->write.result);
+
+				// Checksum of pages not written is not read
+				if (queue->checksum) {
+					_writeQueueTransferDone(slot, BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED, -1, 0, &slot->write.checksumResult);
+				}
+
+				ret = COMMON_NO_ERROR;
+				break;
+			}
+
+			if (! queue->checksum) {
+				break;
+			}
+
+			// Control endpoint keeps order of transfers, checksums are computed after pages are written
+			ret = transport->controlMsgSubmit(
+				bootloader->device,
+				TRANSPORT_DIRECTION_IN,
+				BOOTLOADER_COMMON_COMMAND_FLASH_PAGES_CRC,
+				0,
+				firstPage,
+				slot->crcResponse,
+				pagesCount * 2,
+				_writeQueueTimeout(queue, timeout, transfersAhead + 1),
+				_writeQueueChecksumDone,
+				slot
+			);
+			if (ret != COMMON_NO_ERROR) {
+				ERR(("bootloader_writeQueueSubmit(): USB error '%s'!", transport->strerror()));
+
+				_writeQueueTransferDone(slot, BOOTLOADER_COMMAND_TYPE_NOT_ACCOUNTED, -1, 0, &slot->write.checksumResult);
+
+				ret = COMMON_NO_ERROR;
+			}
+		} while (0);
+	}
+
+	return ret;
+}
+
+
+_U32 bootloader_writeQueuePending(BootloaderWriteQueue *queue) {
+	_U32 ret;
+
+	ASSERT(queue != NULL);
+
+	pthread_mutex_lock(&queue->mutex);
+
+	ret = queue->count;
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	return ret;
+}
+
+
+_BOOL bootloader_writeQueueReap(BootloaderWriteQueue *queue, _BOOL wait, BootloaderQueuedWrite *write) {
+	_BOOL ret = FALSE;
+
+	ASSERT(queue != NULL);
+	ASSERT(write != NULL);
+
+	pthread_mutex_lock(&queue->mutex);
+
+	{
+		WriteQueueSlot *slot = &queue->slots[queue->head];
+
+		while (wait && (queue->count > 0) && (slot->transfersLeft > 0)) {
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+		}
+
+		if ((queue->count > 0) && (slot->transfersLeft == 0)) {
+			memcpy(write, &slot->write, sizeof(*write));
+
+			queue->head = (queue->head + 1) % queue->depth;
+			queue->count--;
+
+			ret = TRUE;
+		}
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	return ret;
+}
+
+
+void bootloader_writeQueueClose(BootloaderWriteQueue *queue) {
+	if (queue != NULL) {
+		pthread_mutex_lock(&queue->mutex);
+
+		while (queue->transfersPending > 0) {
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+		}
+
+		pthread_mutex_unlock(&queue->mutex);
+
+		pthread_cond_destroy(&queue->cond);
+		pthread_mutex_destroy(&queue->mutex);
+
+		free(queue->slots);
+		free(queue);
+	}
+}
+
+
+CommonError bootloader_flashReport(Bootloader *bootloader, BootloaderFlashReport *report, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+	ASSERT(report != NULL);
+
+	do {
+		DBG(("bootloader_flashReport(): Reading flash report"));
+
+		if (! _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_FLASH_COMPARE)) {
+			ret = COMMON_ERROR_NOT_SUPPORTED;
+			break;
+		}
+
+		ret = _mcuCommandFlashReport(bootloader, report, timeout);
+	} while (0);
+
+	return ret;
+}
+
+
+CommonError bootloader_getDeviceStatistics(Bootloader *bootloader, _BOOL clear, BootloaderDeviceStatistics *statistics, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+	ASSERT(statistics != NULL);
+
+	do {
+		DBG(("bootloader_getDeviceStatistics(): Reading device statistics"));
+
+		if (! _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_STATS)) {
+			ret = COMMON_ERROR_NOT_SUPPORTED;
+			break;
+		}
+
+		ret = _mcuCommandGetStats(bootloader, clear, statistics, timeout);
+	} while (0);
+
+	return ret;
+}
+
+
+CommonError bootloader_e2promRead(Bootloader *bootloader, _U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferReadSize) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_e2promRead(): Reading e2prom from: %d, size: %d", address, e2promBufferSize));
+
+		// Block transfers are available since bootloader 0.5
+		if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_E2PROM_BLOCK)) {
+			ret = _mcuCommandE2PromBlockRead(bootloader, address, e2promBuffer, e2promBufferSize, timeout);
+
+		} else {
+			ret = _mcuCommandE2PromRead(bootloader, address, e2promBuffer, e2promBufferSize, timeout);
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_e2promWrite(Bootloader *bootloader, _U32 address, _U8 *e2promBuffer, _U32 e2promBufferSize, _U32 timeout, _U32 *e2promBufferWritten) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_e2promWrite(): Writing e2prom at: %d, size: %d", address, e2promBufferSize));
+
+		if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_E2PROM_BLOCK)) {
+			ret = _mcuCommandE2PromBlockWrite(bootloader, address, e2promBuffer, e2promBufferSize, timeout);
+
+		} else {
+			ret = _mcuCommandE2PromWrite(bootloader, address, e2promBuffer, e2promBufferSize, timeout);
+		}
+
+		// Bytes are only queued by device, wait until they are in e2prom
+		if ((ret == COMMON_NO_ERROR) && _bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_E2PROM_QUEUE)) {
+			ret = _mcuCommandE2PromSync(bootloader, TRUE, NULL, timeout);
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError bootloader_e2promSync(Bootloader *bootloader, _BOOL wait, _U32 *pending, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+
+	{
+		DBG(("bootloader_e2promSync(): wait: %d", wait));
+
+		if (_bootloaderHasCapability(bootloader, BOOTLOADER_COMMON_CAPABILITY_E2PROM_QUEUE)) {
+			ret = _mcuCommandE2PromSync(bootloader, wait, pending, timeout);
+
+		} else if (pending != NULL) {
+			// Older bootloaders write every byte before acknowledging it
+			*pending = 0;
+		}
+	}
+
+	return ret;
+}
+
+
+static int _compareSamples(const void *a, const void *b) {
+	_U32 first  = *(const _U32 *) a;
+	_U32 second = *(const _U32 *) b;
+
+	return (first > second) - (first < second);
+}
+
+
+CommonError bootloader_getStatistics(Bootloader *bootloader, BootloaderStatistics *statistics) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(initialized);
+	ASSERT(bootloader != NULL);
+	ASSERT(statistics != NULL);
+
+	{
+		_U32 i;
+
+		memset(statistics, 0, sizeof(*statistics));
+
+		pthread_mutex_lock(&bootloader->statisticsMutex);
+
+		statistics->time = _getTimeUs() - bootloader->statisticsStart;
+
+		for (i = 0; i < BOOTLOADER_COMMAND_TYPES_COUNT; i++) {
+			CommandStatistics           *source = &bootloader->statistics[i];
+			BootloaderCommandStatistics *dest   = &statistics->commands[i];
+			_U32                        *sorted;
+			_U32                         j;
+
+			dest->count  = source->count;
+			dest->errors = source->errors;
+			dest->bytes  = source->bytes;
+
+			if (source->count == 0) {
+				continue;
+			}
+
+			sorted = malloc(source->count * sizeof(*sorted));
+			if (sorted == NULL) {
+				ERR(("bootloader_getStatistics(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			memcpy(sorted, source->samples, source->count * sizeof(*sorted));
+
+			qsort(sorted, source->count, sizeof(*sorted), _compareSamples);
+
+			for (j = 0; j < source->count; j++) {
+				dest->timeTotal += sorted[j];
+			}
+
+			dest->timeMin     = sorted[0];
+			dest->timeMax     = sorted[source->count - 1];
+			dest->timeAverage = dest->timeTotal / source->count;
+			dest->timeP99     = sorted[(source->count * 99 + 99) / 100 - 1];
+
+			free(sorted);
+		}
+
+		pthread_mutex_unlock(&bootloader->statisticsMutex);
+	}
+
+	return ret;
+}
+
+
+void bootloader_clearStatistics(Bootloader *bootloader) {
+	ASSERT(bootloader != NULL);
+
+	{
+		_U32 i;
+
+		pthread_mutex_lock(&bootloader->statisticsMutex);
+
+		// Samples lists are kept allocated for next commands
+		for (i = 0; i < BOOTLOADER_COMMAND_TYPES_COUNT; i++) {
+			bootloader->statistics[i].count  = 0;
+			bootloader->statistics[i].errors = 0;
+			bootloader->statistics[i].bytes  = 0;
+		}
+
+		bootloader->statisticsStart = _getTimeUs();
+
+		pthread_mutex_unlock(&bootloader->statisticsMutex);
+	}
+}
+
+
+const char *bootloader_commandTypeName(BootloaderCommandType type) {
+	if (type >= BOOTLOADER_COMMAND_TYPES_COUNT) {
+		return "unknown";
+	}
+
+	return commandTypeNames[type];
+}
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "burner/cache.h"
+
+#define DEBUG_LEVEL 4
+#include "burner/common/debug.h"
+
+
+#define CACHE_MAGIC      "JBOOTC1"
+#define CACHE_MAGIC_SIZE 8
+
+// Magic, page size and pages count (little endian), then known flag of every page and pages content
+#define CACHE_HEADER_SIZE (CACHE_MAGIC_SIZE + 4 + 4)
+
+
+static void _putU32(_U8 *buffer, _U32 value) {
+	buffer[0] = value;
+	buffer[1] = value >> 8;
+	buffer[2] = value >> 16;
+	buffer[3] = value >> 24;
+}
+
+
+static _U32 _getU32(const _U8 *buffer) {
+	return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((_U32) buffer[3] << 24);
+}
+
+
+static CommonError _readAll(_S32 file, void *buffer, _U32 bufferSize) {
+	return (read(file, buffer, bufferSize) == bufferSize) ? COMMON_NO_ERROR : COMMON_ERROR;
+}
+
+
+static CommonError _writeAll(_S32 file, const void *buffer, _U32 bufferSize) {
+	return (write(file, buffer, bufferSize) == bufferSize) ? COMMON_NO_ERROR : COMMON_ERROR;
+}
+
+
+// Creates all missing directories of file path
+static void _makeDirectories(const char *path) {
+	char *copy = strdup(path);
+	char *ptr;
+
+	if (copy == NULL) {
+		return;
+	}
+
+	for (ptr = strchr(copy + 1, '/'); ptr != NULL; ptr = strchr(ptr + 1, '/')) {
+		*ptr = '\0';
+
+		if ((mkdir(copy, 0755) != 0) && (errno != EEXIST)) {
+			DBG(("_makeDirectories(): Unable to create '%s'", copy));
+		}
+
+		*ptr = '/';
+	}
+
+	free(copy);
+}
+
+
+CommonError cache_load(const char *path, _U32 pageSize, _U32 pagesCount, _U8 *buffer, _BOOL *pagesKnown) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		_U8  *known = NULL;
+		_S32  file  = -1;
+
+		do {
+			_U8  header[CACHE_HEADER_SIZE];
+			_U32 i;
+
+			memset(pagesKnown, 0, pagesCount * sizeof(*pagesKnown));
+
+			file = open(path, O_RDONLY);
+			if (file < 0) {
+				ret = COMMON_ERROR_NO_DEVICE;
+				break;
+			}
+
+			if (
+				(_readAll(file, header, sizeof(header)) != COMMON_NO_ERROR) ||
+				(memcmp(header, CACHE_MAGIC, CACHE_MAGIC_SIZE) != 0) ||
+				(_getU32(header + CACHE_MAGIC_SIZE)     != pageSize) ||
+				(_getU32(header + CACHE_MAGIC_SIZE + 4) != pagesCount)
+			) {
+				DBG(("cache_load(): Cache '%s' does not match the device.", path));
+
+				ret = COMMON_ERROR_NO_DEVICE;
+				break;
+			}
+
+			known = malloc(pagesCount);
+			if (known == NULL) {
+				ERR(("cache_load(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			if (
+				(_readAll(file, known, pagesCount) != COMMON_NO_ERROR) ||
+				(_readAll(file, buffer, pageSize * pagesCount) != COMMON_NO_ERROR)
+			) {
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			for (i = 0; i < pagesCount; i++) {
+				pagesKnown[i] = (known[i] != 0);
+			}
+		} while (0);
+
+		if (known != NULL) {
+			free(known);
+		}
+
+		if (file >= 0) {
+			close(file);
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError cache_store(const char *path, _U32 pageSize, _U32 pagesCount, const _U8 *buffer, const _BOOL *pagesKnown) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		char *tmpPath = NULL;
+		_U8  *known   = NULL;
+		_S32  file    = -1;
+
+		do {
+			_U8  header[CACHE_HEADER_SIZE];
+			_U32 i;
+
+			tmpPath = malloc(strlen(path) + 5);
+			known   = calloc(pagesCount, 1);
+			if ((tmpPath == NULL) || (known == NULL)) {
+				ERR(("cache_store(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			sprintf(tmpPath, "%s.tmp", path);
+
+			_makeDirectories(path);
+
+			file = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (file < 0) {
+				DBG(("cache_store(): Unable to create '%s'", tmpPath));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			memcpy(header, CACHE_MAGIC, CACHE_MAGIC_SIZE);
+
+			_putU32(header + CACHE_MAGIC_SIZE,     pageSize);
+			_putU32(header + CACHE_MAGIC_SIZE + 4, pagesCount);
+
+			for (i = 0; i < pagesCount; i++) {
+				known[i] = pagesKnown[i] ? 1 : 0;
+			}
+
+			if (
+				(_writeAll(file, header, sizeof(header)) != COMMON_NO_ERROR) ||
+				(_writeAll(file, known, pagesCount) != COMMON_NO_ERROR) ||
+				(_writeAll(file, buffer, pageSize * pagesCount) != COMMON_NO_ERROR)
+			) {
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			close(file);
+
+			file = -1;
+
+			if (rename(tmpPath, path) != 0) {
+				ret = COMMON_ERROR;
+				break;
+			}
+		} while (0);
+
+		if (file >= 0) {
+			close(file);
+		}
+
+		if ((ret != COMMON_NO_ERROR) && (tmpPath != NULL)) {
+			unlink(tmpPath);
+		}
+
+		if (tmpPath != NULL) {
+			free(tmpPath);
+		}
+
+		if (known != NULL) {
+			free(known);
+		}
+	}
+
+	return ret;
+}
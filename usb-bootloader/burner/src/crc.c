@@ -0,0 +1,109 @@
+#include <pthread.h>
+
+#include "bootloader/common/crc8_table.h"
+#include "bootloader/common/protocol.h"
+#include "burner/crc.h"
+
+
+/*
+ * Slicing-by-8: table[k][i] is the remainder of byte i followed by k zero
+ * bytes. CRC is linear, so 8 input bytes are folded with 8 independent
+ * lookups instead of 8 dependent ones.
+ */
+#define CRC_SLICES 8
+
+
+static const _U8 crc8Table[256] = CRC8_TABLE_INITIALIZER;
+
+static _U8  crc8Slices[CRC_SLICES][256];
+static _U16 crc16Slices[CRC_SLICES][256];
+
+static pthread_once_t crcTablesOnce = PTHREAD_ONCE_INIT;
+
+
+static void _crcTablesInitialize(void) {
+	_U32 i;
+	_U32 k;
+
+	for (i = 0; i < 256; i++) {
+		_U16 remainder = i;
+		_U8  bit;
+
+		for (bit = 0; bit < 8; bit++) {
+			if (remainder & 0x0001) {
+				remainder = (remainder >> 1) ^ PAGE_CHECKSUM_POLYNOMIAL;
+
+			} else {
+				remainder = (remainder >> 1);
+			}
+		}
+
+		crc8Slices[0][i]  = crc8Table[i];
+		crc16Slices[0][i] = remainder;
+	}
+
+	for (k = 1; k < CRC_SLICES; k++) {
+		for (i = 0; i < 256; i++) {
+			crc8Slices[k][i]  = crc8Slices[0][crc8Slices[k - 1][i]];
+			crc16Slices[k][i] = (crc16Slices[k - 1][i] >> 8) ^ crc16Slices[0][crc16Slices[k - 1][i] & 0xff];
+		}
+	}
+}
+
+
+_U8 crc8_get(const _U8 *buffer, _U32 bufferSize, _U8 start) {
+	_U8 remainder = start;
+
+	pthread_once(&crcTablesOnce, _crcTablesInitialize);
+
+	while (bufferSize >= CRC_SLICES) {
+		remainder =
+			crc8Slices[7][remainder ^ buffer[0]] ^
+			crc8Slices[6][buffer[1]] ^
+			crc8Slices[5][buffer[2]] ^
+			crc8Slices[4][buffer[3]] ^
+			crc8Slices[3][buffer[4]] ^
+			crc8Slices[2][buffer[5]] ^
+			crc8Slices[1][buffer[6]] ^
+			crc8Slices[0][buffer[7]];
+
+		buffer     += CRC_SLICES;
+		bufferSize -= CRC_SLICES;
+	}
+
+	while (bufferSize--) {
+		remainder = crc8Slices[0][remainder ^ *buffer++];
+	}
+
+	return remainder;
+}
+
+
+_U16 crc16_get(const _U8 *buffer, _U32 bufferSize, _U16 start) {
+	_U16 remainder = start;
+
+	pthread_once(&crcTablesOnce, _crcTablesInitialize);
+
+	while (bufferSize >= CRC_SLICES) {
+		remainder ^= buffer[0] | (buffer[1] << 8);
+
+		remainder =
+			crc16Slices[7][remainder & 0xff] ^
+			crc16Slices[6][remainder >> 8] ^
+			crc16Slices[5][buffer[2]] ^
+			crc16Slices[4][buffer[3]] ^
+			crc16Slices[3][buffer[4]] ^
+			crc16Slices[2][buffer[5]] ^
+			crc16Slices[1][buffer[6]] ^
+			crc16Slices[0][buffer[7]];
+
+		buffer     += CRC_SLICES;
+		bufferSize -= CRC_SLICES;
+	}
+
+	while (bufferSize--) {
+		remainder = (remainder >> 8) ^ crc16Slices[0][(remainder ^ *buffer++) & 0xff];
+	}
+
+	return remainder;
+}
@@ -0,0 +1,433 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "burner/daemon.h"
+
+#define DEBUG_LEVEL 4
+#include "burner/common/debug.h"
+
+
+#define DAEMON_BACKLOG 4
+
+// Client working directory and all arguments have to fit
+#define DAEMON_REQUEST_SIZE_MAX (64 * 1024)
+
+#define DAEMON_ARGUMENTS_MAX 512
+
+
+/*
+ * Request: 32 bit payload size, then working directory and arguments, each
+ * one terminated by '\0'. Response: handler output, '\0' and status byte.
+ */
+
+static volatile sig_atomic_t _stop = 0;
+
+
+static void _signalHandler(int signal) {
+	_stop = 1;
+}
+
+
+static CommonError _readAll(int fd, void *buffer, _U32 bufferSize) {
+	_U8  *ptr  = buffer;
+	_U32  done = 0;
+
+	while (done < bufferSize) {
+		ssize_t ret = read(fd, ptr + done, bufferSize - done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return COMMON_ERROR;
+
+		} else if (ret == 0) {
+			return COMMON_ERROR;
+		}
+
+		done += ret;
+	}
+
+	return COMMON_NO_ERROR;
+}
+
+
+static CommonError _writeAll(int fd, const void *buffer, _U32 bufferSize) {
+	const _U8 *ptr  = buffer;
+	_U32       done = 0;
+
+	while (done < bufferSize) {
+		ssize_t ret = write(fd, ptr + done, bufferSize - done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return COMMON_ERROR;
+		}
+
+		done += ret;
+	}
+
+	return COMMON_NO_ERROR;
+}
+
+
+static CommonError _socketAddress(const char *socketPath, struct sockaddr_un *address) {
+	if (strlen(socketPath) >= sizeof(address->sun_path)) {
+		REPORT_ERR(("Socket path '%s' is too long!", socketPath));
+
+		return COMMON_ERROR_BAD_PARAMETER;
+	}
+
+	memset(address, 0, sizeof(*address));
+
+	address->sun_family = AF_UNIX;
+	strcpy(address->sun_path, socketPath);
+
+	return COMMON_NO_ERROR;
+}
+
+
+static CommonError _handleClient(int client, int workingDirectory, DaemonRequestHandler handler, void *context) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		char *payload = NULL;
+		_U32  payloadSize;
+
+		do {
+			char *argv[DAEMON_ARGUMENTS_MAX + 1];
+			int   argc = 0;
+			char *ptr;
+			char *end;
+			char  status[2];
+			int   savedStdout;
+
+			ret = _readAll(client, &payloadSize, sizeof(payloadSize));
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if ((payloadSize == 0) || (payloadSize > DAEMON_REQUEST_SIZE_MAX)) {
+				ERR(("_handleClient(): Bad request size: %u", payloadSize));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			payload = malloc(payloadSize);
+			if (payload == NULL) {
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			ret = _readAll(client, payload, payloadSize);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if (payload[payloadSize - 1] != '\0') {
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			// First string is client working directory, next ones are arguments
+			ptr = payload;
+			end = payload + payloadSize;
+
+			if (chdir(ptr) != 0) {
+				ERR(("_handleClient(): Unable to enter directory '%s'", ptr));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			ptr += strlen(ptr) + 1;
+
+			argv[argc++] = "burner";
+
+			while ((ptr < end) && (argc < DAEMON_ARGUMENTS_MAX)) {
+				argv[argc++] = ptr;
+
+				ptr += strlen(ptr) + 1;
+			}
+
+			argv[argc] = NULL;
+
+			// Handler output goes directly to the client
+			fflush(stdout);
+
+			savedStdout = dup(STDOUT_FILENO);
+			if (savedStdout < 0) {
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			dup2(client, STDOUT_FILENO);
+
+			status[1] = handler(argc, argv, context);
+
+			fflush(stdout);
+
+			dup2(savedStdout, STDOUT_FILENO);
+			close(savedStdout);
+
+			if (fchdir(workingDirectory) != 0) {
+				ERR(("_handleClient(): Unable to restore working directory!"));
+			}
+
+			status[0] = '\0';
+
+			ret = _writeAll(client, status, sizeof(status));
+		} while (0);
+
+		if (payload != NULL) {
+			free(payload);
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError daemon_run(const char *socketPath, DaemonRequestHandler handler, void *context) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		int sock             = -1;
+		int workingDirectory = -1;
+
+		do {
+			struct sockaddr_un address;
+			struct sigaction   action;
+
+			ret = _socketAddress(socketPath, &address);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			workingDirectory = open(".", O_RDONLY | O_DIRECTORY);
+			if (workingDirectory < 0) {
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			sock = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (sock < 0) {
+				ERR(("daemon_run(): Unable to create socket! (%s)", strerror(errno)));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			// Socket left by previous instance
+			unlink(socketPath);
+
+			if (bind(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+				REPORT_ERR(("Unable to bind socket '%s'! (%s)", socketPath, strerror(errno)));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			if (listen(sock, DAEMON_BACKLOG) != 0) {
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			// Disconnected client must not kill the daemon
+			signal(SIGPIPE, SIG_IGN);
+
+			// No SA_RESTART, accept() has to be interrupted
+			memset(&action, 0, sizeof(action));
+
+			action.sa_handler = _signalHandler;
+
+			sigaction(SIGINT,  &action, NULL);
+			sigaction(SIGTERM, &action, NULL);
+
+			REPORT(("Waiting for requests on %s...", socketPath));
+
+			while (! _stop) {
+				int client = accept(sock, NULL, NULL);
+				if (client < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+
+					ERR(("daemon_run(): accept() failed! (%s)", strerror(errno)));
+
+					ret = COMMON_ERROR;
+					break;
+				}
+
+				if (_handleClient(client, workingDirectory, handler, context) != COMMON_NO_ERROR) {
+					REPORT_ERR(("Request could not be handled!"));
+				}
+
+				close(client);
+			}
+		} while (0);
+
+		if (sock >= 0) {
+			close(sock);
+
+			unlink(socketPath);
+		}
+
+		if (workingDirectory >= 0) {
+			close(workingDirectory);
+		}
+	}
+
+	return ret;
+}
+
+
+CommonError daemon_request(const char *socketPath, int argc, char *argv[], CommonError *result) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		int   sock    = -1;
+		char *payload = NULL;
+
+		do {
+			struct sockaddr_un address;
+			char               workingDirectory[PATH_MAX];
+			_U32               payloadSize;
+			_U32               offset;
+			_BOOL              statusExpected = FALSE;
+			_BOOL              statusReceived = FALSE;
+			int                i;
+
+			ret = _socketAddress(socketPath, &address);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if (getcwd(workingDirectory, sizeof(workingDirectory)) == NULL) {
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			payloadSize = strlen(workingDirectory) + 1;
+			for (i = 0; i < argc; i++) {
+				payloadSize += strlen(argv[i]) + 1;
+			}
+
+			if (payloadSize > DAEMON_REQUEST_SIZE_MAX) {
+				REPORT_ERR(("Request is too long!"));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			payload = malloc(sizeof(payloadSize) + payloadSize);
+			if (payload == NULL) {
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			memcpy(payload, &payloadSize, sizeof(payloadSize));
+
+			offset = sizeof(payloadSize);
+
+			strcpy(payload + offset, workingDirectory);
+			offset += strlen(workingDirectory) + 1;
+
+			for (i = 0; i < argc; i++) {
+				strcpy(payload + offset, argv[i]);
+				offset += strlen(argv[i]) + 1;
+			}
+
+			sock = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (sock < 0) {
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			if (connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+				REPORT_ERR(("Unable to connect to daemon at '%s'! (%s)", socketPath, strerror(errno)));
+
+				ret = COMMON_ERROR_NO_DEVICE;
+				break;
+			}
+
+			ret = _writeAll(sock, payload, offset);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			// Output is passed through until '\0', next byte is the status
+			while (! statusReceived) {
+				char    buffer[256];
+				ssize_t received;
+				ssize_t textSize;
+
+				received = read(sock, buffer, sizeof(buffer));
+				if (received < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+
+					break;
+
+				} else if (received == 0) {
+					break;
+				}
+
+				if (statusExpected) {
+					*result = (CommonError) buffer[0];
+
+					statusReceived = TRUE;
+					break;
+				}
+
+				for (textSize = 0; textSize < received; textSize++) {
+					if (buffer[textSize] == '\0') {
+						break;
+					}
+				}
+
+				fwrite(buffer, 1, textSize, stdout);
+
+				if (textSize < received) {
+					statusExpected = TRUE;
+
+					if (textSize + 1 < received) {
+						*result = (CommonError) buffer[textSize + 1];
+
+						statusReceived = TRUE;
+					}
+				}
+			}
+
+			fflush(stdout);
+
+			if (! statusReceived) {
+				REPORT_ERR(("Connection to daemon was lost!"));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+		} while (0);
+
+		if (sock >= 0) {
+			close(sock);
+		}
+
+		if (payload != NULL) {
+			free(payload);
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,458 @@
+#include <elf.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "burner/image.h"
+
+#define DEBUG_LEVEL 4
+#include "burner/common/debug.h"
+
+
+// AVR toolchain places RAM (0x800000) and e2prom (0x810000) in separate address spaces
+#define IMAGE_ELF_FLASH_ADDRESS_LIMIT  0x800000
+#define IMAGE_ELF_E2PROM_ADDRESS       0x810000
+#define IMAGE_ELF_E2PROM_ADDRESS_LIMIT 0x820000
+
+#define IHEX_RECORD_DATA                     0x00
+#define IHEX_RECORD_END_OF_FILE              0x01
+#define IHEX_RECORD_EXTENDED_SEGMENT_ADDRESS 0x02
+#define IHEX_RECORD_START_SEGMENT_ADDRESS    0x03
+#define IHEX_RECORD_EXTENDED_LINEAR_ADDRESS  0x04
+#define IHEX_RECORD_START_LINEAR_ADDRESS     0x05
+
+
+static CommonError _readFile(const char *path, _U8 **buffer, _U32 *bufferSize) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		_S32 file = -1;
+
+		*buffer = NULL;
+
+		do {
+			struct stat stats = { 0 };
+
+			file = open(path, O_RDONLY);
+			if (file < 0) {
+				REPORT_ERR(("Unable to open input file! (%m)"));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			if (fstat(file, &stats) < 0) {
+				REPORT_ERR(("Unable to stat input file! (%m)"));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			*bufferSize = stats.st_size;
+
+			*buffer = malloc(*bufferSize + 1);
+			if (*buffer == NULL) {
+				ERR(("_readFile(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			if (read(file, *buffer, *bufferSize) != *bufferSize) {
+				REPORT_ERR(("Error reading input file! (%m)"));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+
+			// Terminate text formats
+			(*buffer)[*bufferSize] = '\0';
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (*buffer != NULL) {
+				free(*buffer);
+
+				*buffer = NULL;
+			}
+		}
+
+		if (file >= 0) {
+			close(file);
+		}
+	}
+
+	return ret;
+}
+
+
+static CommonError _imageAddData(Image *image, _U32 address, _U8 *data, _U32 dataSize) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		ImageSegment *segment = NULL;
+
+		_U32 i;
+
+		if (dataSize == 0) {
+			break;
+		}
+
+		if (address + dataSize < address) {
+			REPORT_ERR(("Image data at %#x exceeds address space!", address));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		for (i = 0; i < image->segmentsCount; i++) {
+			ImageSegment *other = &image->segments[i];
+
+			if ((address < other->address + other->size) && (other->address < address + dataSize)) {
+				REPORT_ERR(("Image data at %#x overlaps data at %#x!", address, other->address));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+		}
+
+		if (ret != COMMON_NO_ERROR) {
+			break;
+		}
+
+		// Extend last segment if data is contiguous with it
+		if (image->segmentsCount > 0) {
+			segment = &image->segments[image->segmentsCount - 1];
+
+			if (segment->address + segment->size != address) {
+				segment = NULL;
+			}
+		}
+
+		if (segment == NULL) {
+			ImageSegment *segments = realloc(image->segments, (image->segmentsCount + 1) * sizeof(ImageSegment));
+			if (segments == NULL) {
+				ERR(("_imageAddData(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			image->segments = segments;
+
+			segment = &image->segments[image->segmentsCount++];
+
+			segment->address = address;
+			segment->size    = 0;
+			segment->data    = NULL;
+		}
+
+		{
+			_U8 *segmentData = realloc(segment->data, segment->size + dataSize);
+			if (segmentData == NULL) {
+				ERR(("_imageAddData(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			memcpy(segmentData + segment->size, data, dataSize);
+
+			segment->data  = segmentData;
+			segment->size += dataSize;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+static _S32 _ihexGetByte(const char *text) {
+	_S32 ret = 0;
+	_U32 i;
+
+	for (i = 0; i < 2; i++) {
+		char c = text[i];
+
+		ret <<= 4;
+
+		if (c >= '0' && c <= '9') {
+			ret |= c - '0';
+
+		} else if (c >= 'a' && c <= 'f') {
+			ret |= c - 'a' + 10;
+
+		} else if (c >= 'A' && c <= 'F') {
+			ret |= c - 'A' + 10;
+
+		} else {
+			return -1;
+		}
+	}
+
+	return ret;
+}
+
+
+static CommonError _loadIhex(char *text, Image *image) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		_U32  baseAddress = 0;
+		_U32  lineNumber  = 0;
+		_BOOL endOfFile   = FALSE;
+		char *line        = text;
+
+		while ((line != NULL) && (*line != '\0') && ! endOfFile) {
+			_U8  record[5 + 255];
+			_U32 recordSize;
+			_U8  checksum = 0;
+			_U32 i;
+
+			lineNumber++;
+
+			while ((*line == '\r') || (*line == '\n')) {
+				line++;
+			}
+
+			if (*line == '\0') {
+				break;
+			}
+
+			if (*line != ':') {
+				REPORT_ERR(("Intel HEX: missing start code in line %d!", lineNumber));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			line++;
+
+			// Length, address (2 bytes), type, data, checksum
+			recordSize = 5;
+
+			for (i = 0; i < recordSize; i++) {
+				_S32 byte = _ihexGetByte(line + 2 * i);
+
+				if (byte < 0) {
+					REPORT_ERR(("Intel HEX: malformed record in line %d!", lineNumber));
+
+					ret = COMMON_ERROR_BAD_PARAMETER;
+					break;
+				}
+
+				record[i] = byte;
+
+				if (i == 0) {
+					recordSize += record[0];
+				}
+
+				checksum += record[i];
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if (checksum != 0) {
+				REPORT_ERR(("Intel HEX: bad checksum in line %d!", lineNumber));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			line += 2 * recordSize;
+
+			switch (record[3]) {
+				case IHEX_RECORD_DATA:
+					ret = _imageAddData(image, baseAddress + ((record[1] << 8) | record[2]), record + 4, record[0]);
+					break;
+
+				case IHEX_RECORD_END_OF_FILE:
+					endOfFile = TRUE;
+					break;
+
+				case IHEX_RECORD_EXTENDED_SEGMENT_ADDRESS:
+					baseAddress = ((record[4] << 8) | record[5]) << 4;
+					break;
+
+				case IHEX_RECORD_EXTENDED_LINEAR_ADDRESS:
+					baseAddress = ((record[4] << 8) | record[5]) << 16;
+					break;
+
+				case IHEX_RECORD_START_SEGMENT_ADDRESS:
+				case IHEX_RECORD_START_LINEAR_ADDRESS:
+					break;
+
+				default:
+					REPORT_ERR(("Intel HEX: not supported record type %#x in line %d!", record[3], lineNumber));
+
+					ret = COMMON_ERROR_BAD_PARAMETER;
+					break;
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+static CommonError _loadElf(_U8 *buffer, _U32 bufferSize, ImageMemory memory, Image *image) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		Elf32_Ehdr *header = (Elf32_Ehdr *) buffer;
+		_U32        phOffset;
+		_U16        phCount;
+		_U16        phEntrySize;
+		_U32        i;
+
+		if (
+			(bufferSize < sizeof(Elf32_Ehdr)) ||
+			(header->e_ident[EI_CLASS] != ELFCLASS32) ||
+			(header->e_ident[EI_DATA]  != ELFDATA2LSB)
+		) {
+			REPORT_ERR(("ELF: only 32-bit little endian files are supported!"));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		phOffset    = le32toh(header->e_phoff);
+		phCount     = le16toh(header->e_phnum);
+		phEntrySize = le16toh(header->e_phentsize);
+
+		if (
+			(phEntrySize < sizeof(Elf32_Phdr)) ||
+			(phOffset > bufferSize) ||
+			((_U64) phCount * phEntrySize > bufferSize - phOffset)
+		) {
+			REPORT_ERR(("ELF: malformed program header table!"));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		for (i = 0; i < phCount; i++) {
+			Elf32_Phdr *programHeader = (Elf32_Phdr *) (buffer + phOffset + i * phEntrySize);
+			_U32        address       = le32toh(programHeader->p_paddr);
+			_U32        offset        = le32toh(programHeader->p_offset);
+			_U32        size          = le32toh(programHeader->p_filesz);
+			_U32        memoryStart   = 0;
+			_U32        memoryLimit   = IMAGE_ELF_FLASH_ADDRESS_LIMIT;
+
+			if ((le32toh(programHeader->p_type) != PT_LOAD) || (size == 0)) {
+				continue;
+			}
+
+			if (memory == IMAGE_MEMORY_E2PROM) {
+				memoryStart = IMAGE_ELF_E2PROM_ADDRESS;
+				memoryLimit = IMAGE_ELF_E2PROM_ADDRESS_LIMIT;
+			}
+
+			if ((address < memoryStart) || (address >= memoryLimit)) {
+				DBG(("_loadElf(): Skipping segment at %#x", address));
+
+				continue;
+			}
+
+			if (size > memoryLimit - address) {
+				REPORT_ERR(("ELF: segment %d exceeds its address space!", i));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			if ((offset > bufferSize) || (size > bufferSize - offset)) {
+				REPORT_ERR(("ELF: segment %d exceeds file size!", i));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			DBG(("_loadElf(): Segment at %#x, size: %d", address, size));
+
+			ret = _imageAddData(image, address - memoryStart, buffer + offset, size);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+		}
+
+		if ((ret == COMMON_NO_ERROR) && (image->segmentsCount == 0)) {
+			REPORT_ERR(("ELF: no segment for selected memory type!"));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+CommonError image_load(const char *path, _U32 binaryOffset, ImageMemory memory, Image *image) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	ASSERT(path  != NULL);
+	ASSERT(image != NULL);
+
+	{
+		_U8 *buffer     = NULL;
+		_U32 bufferSize = 0;
+
+		image->segments      = NULL;
+		image->segmentsCount = 0;
+
+		do {
+			ret = _readFile(path, &buffer, &bufferSize);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if ((bufferSize >= SELFMAG) && (memcmp(buffer, ELFMAG, SELFMAG) == 0)) {
+				image->format = IMAGE_FORMAT_ELF;
+
+				ret = _loadElf(buffer, bufferSize, memory, image);
+
+			} else if ((bufferSize > 0) && (buffer[0] == ':')) {
+				image->format = IMAGE_FORMAT_IHEX;
+
+				ret = _loadIhex((char *) buffer, image);
+
+			} else {
+				image->format = IMAGE_FORMAT_BINARY;
+
+				ret = _imageAddData(image, binaryOffset, buffer, bufferSize);
+			}
+		} while (0);
+
+		if (buffer != NULL) {
+			free(buffer);
+		}
+
+		if (ret != COMMON_NO_ERROR) {
+			image_free(image);
+		}
+	}
+
+	return ret;
+}
+
+
+void image_free(Image *image) {
+	_U32 i;
+
+	for (i = 0; i < image->segmentsCount; i++) {
+		free(image->segments[i].data);
+	}
+
+	free(image->segments);
+
+	image->segments      = NULL;
+	image->segmentsCount = 0;
+}
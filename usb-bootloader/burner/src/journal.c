@@ -0,0 +1,308 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "burner/journal.h"
+
+#define DEBUG_LEVEL 4
+#include "burner/common/debug.h"
+
+
+#define JOURNAL_MAGIC "jboot-journal"
+
+#define JOURNAL_LINE_LENGTH_MAX 64
+
+#define JOURNAL_FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define JOURNAL_FNV_PRIME        0x00000100000001b3ULL
+
+
+typedef struct _JournalEntry {
+	_U32 page;
+	_U16 pageCrc;
+} JournalEntry;
+
+
+/*
+ * Text file, header line with image hash followed by one line per finished
+ * page. Records are only appended, so interrupted run leaves valid journal.
+ */
+struct _Journal {
+	char         *path;
+	_S32          file;
+	JournalEntry *entries;
+	_U32          entriesCount;
+	_U32          entriesSize;
+};
+
+
+static _U64 _fnvUpdate(_U64 hash, const _U8 *buffer, _U32 bufferSize) {
+	_U32 i;
+
+	for (i = 0; i < bufferSize; i++) {
+		hash ^= buffer[i];
+		hash *= JOURNAL_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+
+static CommonError _journalAddEntry(Journal *journal, _U32 page, _U16 pageCrc) {
+	if (journal->entriesCount == journal->entriesSize) {
+		_U32          entriesSize = (journal->entriesSize == 0) ? 64 : journal->entriesSize * 2;
+		JournalEntry *entries     = realloc(journal->entries, entriesSize * sizeof(*entries));
+
+		if (entries == NULL) {
+			ERR(("_journalAddEntry(): No more free memory!"));
+
+			return COMMON_ERROR_NO_FREE_RESOURCES;
+		}
+
+		journal->entries     = entries;
+		journal->entriesSize = entriesSize;
+	}
+
+	journal->entries[journal->entriesCount].page    = page;
+	journal->entries[journal->entriesCount].pageCrc = pageCrc;
+
+	journal->entriesCount++;
+
+	return COMMON_NO_ERROR;
+}
+
+
+// Loads entries of journal left by previous run, returns FALSE if it is missing or belongs to other image
+static _BOOL _journalLoad(Journal *journal, _U64 imageHash) {
+	_BOOL ret = FALSE;
+
+	{
+		FILE *file = fopen(journal->path, "r");
+
+		do {
+			char               line[JOURNAL_LINE_LENGTH_MAX];
+			unsigned long long hash;
+
+			if (file == NULL) {
+				break;
+			}
+
+			if (fgets(line, sizeof(line), file) == NULL) {
+				break;
+			}
+
+			if ((sscanf(line, JOURNAL_MAGIC " %llx", &hash) != 1) || (hash != imageHash)) {
+				DBG(("_journalLoad(): Journal '%s' belongs to other image.", journal->path));
+
+				break;
+			}
+
+			ret = TRUE;
+
+			while (fgets(line, sizeof(line), file) != NULL) {
+				unsigned int page;
+				unsigned int pageCrc;
+
+				// Last line may be incomplete if writing was interrupted
+				if ((strchr(line, '\n') == NULL) || (sscanf(line, "%u %x", &page, &pageCrc) != 2)) {
+					break;
+				}
+
+				if (_journalAddEntry(journal, page, pageCrc) != COMMON_NO_ERROR) {
+					ret = FALSE;
+					break;
+				}
+			}
+		} while (0);
+
+		if (file != NULL) {
+			fclose(file);
+		}
+	}
+
+	return ret;
+}
+
+
+static CommonError _journalWrite(Journal *journal, const char *line) {
+	_U32 lineLength = strlen(line);
+
+	if (write(journal->file, line, lineLength) != lineLength) {
+		REPORT_ERR(("Unable to write journal '%s'! (%m)", journal->path));
+
+		return COMMON_ERROR;
+	}
+
+	if (fdatasync(journal->file) != 0) {
+		REPORT_ERR(("Unable to flush journal '%s'! (%m)", journal->path));
+
+		return COMMON_ERROR;
+	}
+
+	return COMMON_NO_ERROR;
+}
+
+
+_U64 journal_imageHash(const Image *image) {
+	_U64 ret = JOURNAL_FNV_OFFSET_BASIS;
+	_U32 i;
+
+	for (i = 0; i < image->segmentsCount; i++) {
+		_U8 address[4];
+
+		address[0] = image->segments[i].address;
+		address[1] = image->segments[i].address >> 8;
+		address[2] = image->segments[i].address >> 16;
+		address[3] = image->segments[i].address >> 24;
+
+		ret = _fnvUpdate(ret, address, sizeof(address));
+		ret = _fnvUpdate(ret, image->segments[i].data, image->segments[i].size);
+	}
+
+	return ret;
+}
+
+
+CommonError journal_open(Journal **journal, const char *path, _U64 imageHash) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		Journal *context = NULL;
+
+		do {
+			context = calloc(1, sizeof(Journal));
+			if (context == NULL) {
+				ERR(("journal_open(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			context->file = -1;
+
+			context->path = strdup(path);
+			if (context->path == NULL) {
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			if (_journalLoad(context, imageHash)) {
+				context->file = open(path, O_WRONLY | O_APPEND);
+
+			} else {
+				char header[JOURNAL_LINE_LENGTH_MAX];
+
+				context->entriesCount = 0;
+
+				context->file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (context->file >= 0) {
+					snprintf(header, sizeof(header), JOURNAL_MAGIC " %016llx\n", (unsigned long long) imageHash);
+
+					ret = _journalWrite(context, header);
+					if (ret != COMMON_NO_ERROR) {
+						break;
+					}
+				}
+			}
+
+			if (context->file < 0) {
+				REPORT_ERR(("Unable to open journal '%s'! (%m)", path));
+
+				ret = COMMON_ERROR;
+				break;
+			}
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (context != NULL) {
+				journal_close(context, FALSE);
+
+				context = NULL;
+			}
+		}
+
+		*journal = context;
+	}
+
+	return ret;
+}
+
+
+_BOOL journal_isPageDone(Journal *journal, _U32 page, _U16 pageCrc) {
+	_U32 i;
+
+	// The latest record of page is the valid one
+	for (i = journal->entriesCount; i > 0; i--) {
+		if (journal->entries[i - 1].page == page) {
+			return journal->entries[i - 1].pageCrc == pageCrc;
+		}
+	}
+
+	return FALSE;
+}
+
+
+CommonError journal_pagesDone(Journal *journal, _U32 firstPage, _U32 pagesCount, const _U16 *pagesCrc) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		char *lines = NULL;
+
+		do {
+			_U32 linesLength = 0;
+			_U32 i;
+
+			lines = malloc(pagesCount * JOURNAL_LINE_LENGTH_MAX + 1);
+			if (lines == NULL) {
+				ERR(("journal_pagesDone(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			lines[0] = '\0';
+
+			for (i = 0; i < pagesCount; i++) {
+				ret = _journalAddEntry(journal, firstPage + i, pagesCrc[i]);
+				if (ret != COMMON_NO_ERROR) {
+					break;
+				}
+
+				linesLength += sprintf(lines + linesLength, "%u %04x\n", firstPage + i, pagesCrc[i]);
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			ret = _journalWrite(journal, lines);
+		} while (0);
+
+		if (lines != NULL) {
+			free(lines);
+		}
+	}
+
+	return ret;
+}
+
+
+void journal_close(Journal *journal, _BOOL remove) {
+	if (journal->file >= 0) {
+		close(journal->file);
+	}
+
+	if (remove && (journal->path != NULL)) {
+		unlink(journal->path);
+	}
+
+	if (journal->path != NULL) {
+		free(journal->path);
+	}
+
+	if (journal->entries != NULL) {
+		free(journal->entries);
+	}
+
+	free(journal);
+}
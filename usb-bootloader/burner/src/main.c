@@ -1,14 +1,21 @@
 #include <getopt.h>
+#include <pthread.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "bootloader/common/protocol.h"
 
 #include "burner/common/types.h"
 #include "burner/bootloader.h"
+#include "burner/cache.h"
+#include "burner/crc.h"
+#include "burner/daemon.h"
+#include "burner/image.h"
+#include "burner/journal.h"
 
 #define DEBUG_LEVEL 4
 #include "burner/common/debug.h"
@@ -18,6 +25,18 @@
 
 #define BOOTLOADER_TIMEOUT 3000
 
+#define BURNER_DEVICES_MAX 32
+
+#define BURNER_OPERATIONS_MAX 32
+
+#define BURNER_SCRIPT_ARGUMENTS_MAX 256
+
+// Pages written in one request, transfer of one chunk overlaps with preparation of the next ones
+#define BURNER_PIPELINE_CHUNK_PAGES 16
+
+// Chunks written and verified by device while the next ones are being sent
+#define BURNER_WRITE_QUEUE_DEPTH 4
+
 
 typedef enum _BurnerOperation {
 	BURNER_OPERATION_NONE,
@@ -26,6 +45,18 @@ typedef enum _BurnerOperation {
 	BURNER_OPERATION_WRITE
 } BurnerOperationType;
 
+typedef enum _BurnerVerifyMode {
+	BURNER_VERIFY_MODE_CRC,
+	BURNER_VERIFY_MODE_READBACK,
+	BURNER_VERIFY_MODE_NONE
+} BurnerVerifyMode;
+
+typedef enum _BurnerStatisticsFormat {
+	BURNER_STATISTICS_FORMAT_NONE,
+	BURNER_STATISTICS_FORMAT_TEXT,
+	BURNER_STATISTICS_FORMAT_JSON
+} BurnerStatisticsFormat;
+
 typedef enum _BurnerMemoryType {
 	BURNER_MEMORY_TYPE_NONE,
 	BURNER_MEMORY_TYPE_FLASH,
@@ -55,18 +86,39 @@ typedef struct _BurnerOperationDescription {
 	struct {
 		char input[PATH_LENGTH_MAX];
 		char output[PATH_LENGTH_MAX];
+		char journal[PATH_LENGTH_MAX];
 	} path;
 
-	_BOOL reset;
-	_BOOL commit;
+	_BOOL resume;
+
+	_BOOL differential;
+
+	BurnerVerifyMode verifyMode;
 
 	BurnerMemoryType memoryType;
 } BurnerOperationDescription;
 
 
+// Operations executed in order over single connection, followed by commit and reset
+typedef struct _BurnerSession {
+	BurnerOperationDescription operations[BURNER_OPERATIONS_MAX];
+	_U32                       operationsCount;
+
+	_BOOL reset;
+	_BOOL commit;
+
+	BurnerStatisticsFormat statistics;
+
+	char statisticsPath[PATH_LENGTH_MAX]; // Empty if statistics are printed to standard output
+
+	char cacheDirectory[PATH_LENGTH_MAX]; // Empty if flash cache is not used
+} BurnerSession;
+
+
 typedef struct _FlashMemoryBlock {
 	_U8  *data;
 	_BOOL read;
+	_BOOL erased; // Erased by this session, journal of previous run is not valid for it
 } FlashMemoryBlock;
 
 
@@ -75,6 +127,7 @@ typedef struct _FlashMemory {
 	_U32              blockSize;
 	_U32              blocksCount;
 	FlashMemoryBlock *blocks;
+	_U32              usedSize; // End of image data written in this run, 0 if unknown
 } FlashMemory;
 
 
@@ -84,6 +137,63 @@ typedef struct _E2promMemory {
 } E2promMemory;
 
 
+typedef struct _BurnerDevice {
+	BootloaderDeviceId          id;
+	BurnerSession              *session;
+	pthread_t                   thread;
+	_BOOL                       started;
+	CommonError                 result;
+	_U32                        time;
+	char                       *statistics;
+} BurnerDevice;
+
+
+// Device counters of one session, read before reset loses connection
+typedef struct _BurnerDeviceStatistics {
+	_BOOL                      valid;
+	BootloaderDeviceStatistics counters;
+} BurnerDeviceStatistics;
+
+
+// Command line, parsed also for every request received by daemon
+typedef struct _BurnerOptions {
+	BurnerSession       session;
+	BootloaderTransport transport;
+	const char         *transportParameter;
+	BootloaderDeviceId  devices[BURNER_DEVICES_MAX];
+	_U32                devicesCount;
+	_BOOL               allDevices;
+	BurnerVerifyMode    verifyMode;
+	_BOOL               differential;
+	const char         *daemonSocket;
+	const char         *clientSocket;
+} BurnerOptions;
+
+
+// Connection kept open by daemon between requests
+typedef struct _BurnerDaemon {
+	const char                  *deviceId;
+	Bootloader                  *bootloader;
+	BootloaderTargetInformation  targetInformation;
+} BurnerDaemon;
+
+
+// Prepares page images and their expected checksums ahead of USB transfers
+typedef struct _BurnerPagesProducer {
+	FlashMemory     *flash;
+	Image           *image;
+	_U32            *pagesFill;
+	_U16            *pagesCrc;
+	_U32             firstPage;
+	_U32             lastPage;
+
+	pthread_t        thread;
+	pthread_mutex_t  mutex;
+	pthread_cond_t   cond;
+	_U32             pagesReady; // Pages below this one are prepared
+} BurnerPagesProducer;
+
+
 static void debug_dump(void *buffer, int bufferSize) {
 	_U32 offset = 0;
 	_U32 lineElementsCount = 16;
@@ -123,6 +233,21 @@ static void debug_dump(void *buffer, int bufferSize) {
 }
 
 
+static _U32 _getTime(void) {
+	_U32 ret = 0;
+
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+
+		ret = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+
+	return ret;
+}
+
+
 static void _getPageNumberByOffsetAndSize(_U32 pageSize, _U32 pagesCount, _U32 offset, _U32 size, _S32 *pageStart, _S32 *pageEnd) {
 
 	{
@@ -160,13 +285,13 @@ static void _getPageNumberByOffsetAndSize(_U32 pageSize, _U32 pagesCount, _U32 o
 }
 
 
-static CommonError _handleReadE2prom(E2promMemory *e2prom, _U32 offset, _U32 size) {
+static CommonError _handleReadE2prom(Bootloader *bootloader, E2promMemory *e2prom, _U32 offset, _U32 size) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	{
 		REPORT(("Reading %d bytes from e2prom at offset: %d", size, offset));
 
-		ret = bootloader_e2promRead(offset, e2prom->buffer + offset, size, BOOTLOADER_TIMEOUT, NULL);
+		ret = bootloader_e2promRead(bootloader, offset, e2prom->buffer + offset, size, BOOTLOADER_TIMEOUT, NULL);
 		if (ret != COMMON_NO_ERROR) {
 			REPORT_ERR(("Unable to read e2prom memory!"));
 		}
@@ -176,29 +301,45 @@ static CommonError _handleReadE2prom(E2promMemory *e2prom, _U32 offset, _U32 siz
 }
 
 
-static CommonError _handleReadFlash(FlashMemory *flash, _U32 offset, _U32 size) {
+static CommonError _handleReadFlash(Bootloader *bootloader, FlashMemory *flash, _U32 offset, _U32 size) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
 		_S32 pageStart   = -1;
 		_S32 pageEnd     = -1;
-		_U32 lastPage    = 0;
-		_U32 currentPage = 1;
 
 		_getPageNumberByOffsetAndSize(flash->blockSize, flash->blocksCount, offset, size, &pageStart, &pageEnd);
 
 		DBG(("_handleReadFlash(): Reading pages: %d - %d", pageStart, pageEnd));
 
+		// Pages already known (written, cached or read before) are not read again
 		{
-			_U32 i;
+			_S32 i = pageStart;
 
-			for (i = pageStart; i <= pageEnd; i++) {
-				ret = bootloader_flashPageRead(i, flash->blocks[i].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+			while (i <= pageEnd) {
+				_S32 runEnd = i;
+
+				if (flash->blocks[i].read) {
+					i++;
+					continue;
+				}
+
+				while ((runEnd <= pageEnd) && ! flash->blocks[runEnd].read) {
+					runEnd++;
+				}
+
+				ret = bootloader_flashPagesRead(bootloader, i, runEnd - i, flash->blocks[i].data, BOOTLOADER_TIMEOUT);
 				if (ret != COMMON_NO_ERROR) {
 					REPORT_ERR(("Error reading from flash!"));
 
 					break;
 				}
+
+				while (i < runEnd) {
+					flash->blocks[i].read = TRUE;
+
+					i++;
+				}
 			}
 		}
 	} while (0);
@@ -207,7 +348,7 @@ static CommonError _handleReadFlash(FlashMemory *flash, _U32 offset, _U32 size)
 }
 
 
-static CommonError _handleRead(BurnerOperationDescription *operation, FlashMemory *flash, E2promMemory *e2prom) {
+static CommonError _handleRead(Bootloader *bootloader, BurnerOperationDescription *operation, FlashMemory *flash, E2promMemory *e2prom) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	{
@@ -256,10 +397,10 @@ static CommonError _handleRead(BurnerOperationDescription *operation, FlashMemor
 
 			// Read memory
 			if (operation->memoryType == BURNER_MEMORY_TYPE_FLASH) {
-				ret = _handleReadFlash(flash, operation->parameters.read.offset, operation->parameters.read.size);
+				ret = _handleReadFlash(bootloader, flash, operation->parameters.read.offset, operation->parameters.read.size);
 
 			} else {
-				ret = _handleReadE2prom(e2prom, operation->parameters.read.offset, operation->parameters.read.size);
+				ret = _handleReadE2prom(bootloader, e2prom, operation->parameters.read.offset, operation->parameters.read.size);
 			}
 			if (ret != COMMON_NO_ERROR) {
 				break;
@@ -271,7 +412,7 @@ static CommonError _handleRead(BurnerOperationDescription *operation, FlashMemor
 					write(outputFile, flash->buffer + operation->parameters.read.offset, operation->parameters.read.size);
 
 				} else {
-					write(outputFile, e2prom + operation->parameters.read.offset, operation->parameters.read.size);
+					write(outputFile, e2prom->buffer + operation->parameters.read.offset, operation->parameters.read.size);
 				}
 
 			} else {
@@ -293,7 +434,23 @@ static CommonError _handleRead(BurnerOperationDescription *operation, FlashMemor
 }
 
 
-static CommonError _handleErase(BurnerOperationDescription *operation, FlashMemory *flash, E2promMemory *e2prom) {
+// Bootloaders comparing pages before programming tell how much work was avoided
+static void _reportFlashWork(Bootloader *bootloader) {
+	BootloaderFlashReport report;
+
+	if (bootloader_flashReport(bootloader, &report, BOOTLOADER_TIMEOUT) == COMMON_NO_ERROR) {
+		if (report.pagesUnchanged > 0) {
+			REPORT(("%d pages already held written data, device did not program them.", report.pagesUnchanged));
+		}
+
+		if (report.erasesSkipped > 0) {
+			REPORT(("%d pages were already blank, device did not erase them.", report.erasesSkipped));
+		}
+	}
+}
+
+
+static CommonError _handleErase(Bootloader *bootloader, BurnerOperationDescription *operation, FlashMemory *flash, E2promMemory *e2prom) {
 	CommonError ret = COMMON_NO_ERROR;
 
 	do {
@@ -304,18 +461,37 @@ static CommonError _handleErase(BurnerOperationDescription *operation, FlashMemo
 			break;
 		}
 
+		if (operation->parameters.erase.startPage > operation->parameters.erase.endPage) {
+			REPORT_ERR(("First page is after the last one!"));
+
+			ret = COMMON_ERROR_BAD_PARAMETER;
+			break;
+		}
+
+		ret = bootloader_flashPagesErase(
+			bootloader,
+			operation->parameters.erase.startPage,
+			operation->parameters.erase.endPage - operation->parameters.erase.startPage + 1,
+			BOOTLOADER_TIMEOUT
+		);
+		if (ret != COMMON_NO_ERROR) {
+			REPORT_ERR(("Unable to erase pages %d - %d!", operation->parameters.erase.startPage, operation->parameters.erase.endPage));
+
+			break;
+		}
+
+		REPORT(("Pages %d - %d erased.", operation->parameters.erase.startPage, operation->parameters.erase.endPage));
+
+		_reportFlashWork(bootloader);
+
 		{
 			_U32 i;
 
 			for (i = operation->parameters.erase.startPage; i <= operation->parameters.erase.endPage; i++) {
-				ret = bootloader_flashPageErase(i, BOOTLOADER_TIMEOUT);
-				if (ret != COMMON_NO_ERROR) {
-					REPORT_ERR(("Unable to erase page %d!", i));
-
-					break;
-				}
+				memset(flash->blocks[i].data, 0xff, flash->blockSize);
 
-				REPORT(("Page %d erased.", i));
+				flash->blocks[i].read   = TRUE;
+				flash->blocks[i].erased = TRUE;
 			}
 		}
 	} while (0);
@@ -324,92 +500,110 @@ static CommonError _handleErase(BurnerOperationDescription *operation, FlashMemo
 }
 
 
-static CommonError _handleWriteFlash(FlashMemory *flash, _U32 offset, _U8 *buffer, _U32 bufferSize) {
-	CommonError ret = COMMON_NO_ERROR;
-
-	do {
-		_S32 pageStart = -1;
-		_S32 pageEnd   = -1;
-
-		DBG(("_handleWriteFlash(): Call for offset: %d, size: %d", offset, bufferSize));
+static void *_pagesProducerThread(void *arg) {
+	BurnerPagesProducer *producer = arg;
+	FlashMemory         *flash    = producer->flash;
+	_U32                 page;
 
-		_getPageNumberByOffsetAndSize(flash->blockSize, flash->blocksCount, offset, bufferSize, &pageStart, &pageEnd);
+	for (page = producer->firstPage; page <= producer->lastPage; page++) {
+		_U32 pageStart = page * flash->blockSize;
+		_U32 pageEnd   = pageStart + flash->blockSize;
+		_U32 i;
 
-		DBG(("_handleWriteFlash(): Writing pages: %d - %d", pageStart, pageEnd));
+		if (producer->pagesFill[page] != 0) {
+			for (i = 0; i < producer->image->segmentsCount; i++) {
+				ImageSegment *segment = &producer->image->segments[i];
+				_U32          from    = segment->address;
+				_U32          to      = segment->address + segment->size;
 
-		if (offset % flash->blockSize != 0) {
-			DBG(("_handleWriteFlash(): Reading %d page.", pageStart));
+				if (from < pageStart) {
+					from = pageStart;
+				}
 
-			ret = bootloader_flashPageRead(pageStart, flash->blocks[pageStart].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
-			if (ret != COMMON_NO_ERROR) {
-				ERR(("_handleWriteFlash(): Error reading from flash!"));
+				if (to > pageEnd) {
+					to = pageEnd;
+				}
 
-				break;
+				if (from < to) {
+					memcpy(flash->buffer + from, segment->data + (from - segment->address), to - from);
+				}
 			}
 
-			flash->blocks[pageStart].read = TRUE;
+			producer->pagesCrc[page] = crc16_get(flash->blocks[page].data, flash->blockSize, PAGE_CHECKSUM_INITIAL);
 		}
 
-		if (
-			((offset + bufferSize) % flash->blockSize != 0) &&
-			(pageStart != pageEnd)
-		) {
-			DBG(("_handleWriteFlash(): Reading %d page.", pageEnd));
+		pthread_mutex_lock(&producer->mutex);
+		producer->pagesReady = page + 1;
+		pthread_cond_broadcast(&producer->cond);
+		pthread_mutex_unlock(&producer->mutex);
+	}
 
-			ret = bootloader_flashPageRead(pageEnd, flash->blocks[pageEnd].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
-			if (ret != COMMON_NO_ERROR) {
-				ERR(("_handleWriteFlash(): Error reading from flash!"));
+	return NULL;
+}
 
-				break;
-			}
 
-			flash->blocks[pageEnd].read = TRUE;
-		}
+static void _pagesProducerWait(BurnerPagesProducer *producer, _U32 page) {
+	pthread_mutex_lock(&producer->mutex);
 
-		memcpy(flash->buffer + offset, buffer, bufferSize);
+	while (producer->pagesReady <= page) {
+		pthread_cond_wait(&producer->cond, &producer->mutex);
+	}
 
-		{
-			_U8 *pageBuffer = NULL;
+	pthread_mutex_unlock(&producer->mutex);
+}
 
-			pageBuffer = malloc(flash->blockSize);
-			if (pageBuffer == NULL) {
-				ERR(("_handleWriteFlash(): No more free memory!"));
 
-				ret = COMMON_ERROR_NO_FREE_RESOURCES;
-				break;
-			}
+static CommonError _verifyFlashPages(Bootloader *bootloader, FlashMemory *flash, _U32 firstPage, _U32 pagesCount, BurnerVerifyMode verifyMode, _U16 *expectedCrc, _U8 *pagesBuffer) {
+	CommonError ret = COMMON_NO_ERROR;
 
-			while (pageStart <= pageEnd) {
-				REPORT(("Erasing page   %d.", pageStart));
-				ret |= bootloader_flashPageErase(pageStart, BOOTLOADER_TIMEOUT);
+	do {
+		if (verifyMode == BURNER_VERIFY_MODE_NONE) {
+			break;
+		}
 
-				REPORT(("Writing page   %d.", pageStart));
-				ret |= bootloader_flashPageWrite(pageStart, flash->blocks[pageStart].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+		REPORT(("Verifying pages %d - %d.", firstPage, firstPage + pagesCount - 1));
 
-				REPORT(("Verifying page %d.", pageStart));
-				ret |= bootloader_flashPageRead(pageStart, pageBuffer, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+		if (verifyMode == BURNER_VERIFY_MODE_CRC) {
+			_U16 pagesCrc[BURNER_PIPELINE_CHUNK_PAGES];
+			_U32 i;
 
-				if (ret != COMMON_NO_ERROR) {
-					REPORT_ERR(("Unable to write page %d!", pageStart));
+			ASSERT(pagesCount <= BURNER_PIPELINE_CHUNK_PAGES);
 
-					break;
-				}
+			ret = bootloader_flashPagesCrc(bootloader, firstPage, pagesCount, pagesCrc, BOOTLOADER_TIMEOUT);
+			if (ret == COMMON_NO_ERROR) {
+				for (i = 0; i < pagesCount; i++) {
+					if (pagesCrc[i] != expectedCrc[firstPage + i]) {
+						REPORT_ERR(("Verification of page %d failed!", firstPage + i));
 
-				if (memcmp(pageBuffer, flash->blocks[pageStart].data, flash->blockSize) != 0) {
-					REPORT_ERR(("Verification failed!"));
+						ret = COMMON_ERROR;
+						break;
+					}
+				}
+			}
 
-					ret = COMMON_ERROR;
-					break;
+			if (ret != COMMON_ERROR_NOT_SUPPORTED) {
+				if ((ret != COMMON_NO_ERROR) && (ret != COMMON_ERROR)) {
+					REPORT_ERR(("Unable to read checksum of pages %d - %d!", firstPage, firstPage + pagesCount - 1));
 				}
 
-				REPORT(("Page %d has written and verified.", pageStart));
+				break;
+			}
+
+			DBG(("_verifyFlashPages(): Checksum not supported by bootloader, reading pages back."));
+		}
 
-				flash->blocks[pageStart].read = TRUE;
+		ret = bootloader_flashPagesRead(bootloader, firstPage, pagesCount, pagesBuffer, BOOTLOADER_TIMEOUT);
+		if (ret != COMMON_NO_ERROR) {
+			REPORT_ERR(("Unable to read pages %d - %d!", firstPage, firstPage + pagesCount - 1));
 
-				pageStart++;
-			}
+			break;
+		}
 
-			free(pageBuffer);
+		if (memcmp(pagesBuffer, flash->blocks[firstPage].data, pagesCount * flash->blockSize) != 0) {
+			REPORT_ERR(("Verification failed!"));
+
+			ret = COMMON_ERROR;
+			break;
 		}
 	} while (0);
 
@@ -417,103 +611,95 @@ static CommonError _handleWriteFlash(FlashMemory *flash, _U32 offset, _U8 *buffe
 }
 
 
-static CommonError _handleWriteE2prom(E2promMemory *e2prom, _U32 offset, _U8 *buffer, _U32 bufferSize) {
-	CommonError ret = COMMON_NO_ERROR;
-
-	{
-		REPORT(("Writing %d bytes to e2prom at offset: %d", bufferSize, offset));
-
-		ret = bootloader_e2promWrite(offset, buffer, bufferSize, BOOTLOADER_TIMEOUT, NULL);
-		if (ret != COMMON_NO_ERROR) {
-			REPORT_ERR(("Unable to write e2prom memory!"));
-		}
+/*
+ * Journal may be stale, e.g. the device was flashed by other tool in between.
+ * Page recorded there is skipped only if the device still holds it, checksums
+ * of pages are read once, when the first recorded page is found.
+ */
+static _BOOL _journalPageDone(Bootloader *bootloader, FlashMemory *flash, Journal *journal, _U32 page, _U32 firstPage, _U32 lastPage, _U16 *pagesCrc, _U16 **deviceCrc, _BOOL *deviceCrcRead) {
+	if ((journal == NULL) || flash->blocks[page].erased || ! journal_isPageDone(journal, page, pagesCrc[page])) {
+		return FALSE;
 	}
 
-	return ret;
-}
+	if (! *deviceCrcRead) {
+		*deviceCrcRead = TRUE;
 
+		*deviceCrc = malloc((lastPage - firstPage + 1) * sizeof(**deviceCrc));
+		if (*deviceCrc == NULL) {
+			ERR(("_journalPageDone(): No more free memory!"));
 
-static CommonError _handleWrite(BurnerOperationDescription *operation, FlashMemory *flash, E2promMemory *e2prom) {
-	CommonError ret = COMMON_NO_ERROR;
+		} else if (bootloader_flashPagesCrc(bootloader, firstPage, lastPage - firstPage + 1, *deviceCrc, BOOTLOADER_TIMEOUT) != COMMON_NO_ERROR) {
+			REPORT(("Unable to check pages written by previous run, writing them again."));
 
-	{
-		_S32 inputFile       = -1;
-		_U8 *inputFileBuffer = NULL;
+			free(*deviceCrc);
 
-		do {
-			_U32 memorySize;
-			_U32 inputFileSize;
+			*deviceCrc = NULL;
+		}
+	}
 
-			inputFile = open(operation->path.input, O_RDONLY);
-			if (inputFile < 0) {
-				REPORT_ERR(("Unable to open input file! (%m)"));
+	return (*deviceCrc != NULL) && ((*deviceCrc)[page - firstPage] == pagesCrc[page]);
+}
 
-				ret = COMMON_ERROR;
-				break;
-			}
 
-			{
-				struct stat stats = { 0 };
+// Takes chunks finished by device, in order, until no more than keepPending of them are in flight
+static CommonError _reapWrittenPages(BootloaderWriteQueue *queue, FlashMemory *flash, BurnerVerifyMode verifyMode, _U16 *pagesCrc, Journal *journal, _U32 keepPending) {
+	CommonError ret = COMMON_NO_ERROR;
 
-				if (fstat(inputFile, &stats) < 0) {
-					REPORT_ERR(("Unable to stat input file! (%m)"));
+	while (bootloader_writeQueuePending(queue) > keepPending) {
+		BootloaderQueuedWrite write;
+		_U32                  lastPage;
+		_U32                  i;
 
-					ret = COMMON_ERROR;
-					break;
-				}
+		bootloader_writeQueueReap(queue, TRUE, &write);
 
-				inputFileSize = stats.st_size;
-			}
+		lastPage = write.firstPage + write.pagesCount - 1;
 
-			if (operation->memoryType == BURNER_MEMORY_TYPE_FLASH) {
-				// Prereserve memory for checksum
-				memorySize = flash->blockSize * flash->blocksCount - 2;
+		if (write.result != COMMON_NO_ERROR) {
+			REPORT_ERR(("Unable to write pages %d - %d!", write.firstPage, lastPage));
 
-			} else {
-				memorySize = e2prom->size;
-			}
+			ret = write.result;
+			break;
+		}
 
-			if (inputFileSize + operation->parameters.write.offset > memorySize) {
-				REPORT_ERR(("Input file doesn't fit into memory!"));
+		if (verifyMode == BURNER_VERIFY_MODE_CRC) {
+			if (write.checksumResult != COMMON_NO_ERROR) {
+				REPORT_ERR(("Unable to read checksum of pages %d - %d!", write.firstPage, lastPage));
 
-				ret = COMMON_ERROR;
+				ret = write.checksumResult;
 				break;
 			}
 
-			inputFileBuffer = malloc(inputFileSize);
-			if (inputFileBuffer == NULL) {
-				ERR(("_handleWrite(): No more free memory!"));
+			for (i = 0; i < write.pagesCount; i++) {
+				if (write.pagesCrc[i] != pagesCrc[write.firstPage + i]) {
+					REPORT_ERR(("Verification of page %d failed!", write.firstPage + i));
 
-				ret = COMMON_ERROR_NO_FREE_RESOURCES;
-				break;
+					ret = COMMON_ERROR;
+					break;
+				}
 			}
 
-			if (read(inputFile, inputFileBuffer, inputFileSize) != inputFileSize) {
-				REPORT_ERR(("Error reading input file! (%m)"));
-
-				ret = COMMON_ERROR;
+			if (ret != COMMON_NO_ERROR) {
 				break;
 			}
+		}
 
-			if (operation->memoryType == BURNER_MEMORY_TYPE_FLASH) {
-				ret = _handleWriteFlash(flash, operation->parameters.write.offset, inputFileBuffer, inputFileSize);
-
-			} else {
-				ret = _handleWriteE2prom(e2prom, operation->parameters.write.offset, inputFileBuffer, inputFileSize);
-			}
+		// Pages which were not verified are not trusted by next run
+		if ((journal != NULL) && (verifyMode != BURNER_VERIFY_MODE_NONE)) {
+			ret = journal_pagesDone(journal, write.firstPage, write.pagesCount, &pagesCrc[write.firstPage]);
 			if (ret != COMMON_NO_ERROR) {
-				REPORT_ERR(("Error writing input file to '%s' memory!.", operation->memoryType == BURNER_MEMORY_TYPE_FLASH ? "flash" : "e2prom"));
-
 				break;
 			}
-		} while (0);
+		}
 
-		if (inputFileBuffer != NULL) {
-			free(inputFileBuffer);
+		if (verifyMode == BURNER_VERIFY_MODE_NONE) {
+			REPORT(("Pages %d - %d have written.", write.firstPage, lastPage));
+
+		} else {
+			REPORT(("Pages %d - %d have written and verified.", write.firstPage, lastPage));
 		}
 
-		if (inputFile >= 0) {
-			close(inputFile);
+		for (i = write.firstPage; i <= lastPage; i++) {
+			flash->blocks[i].read = TRUE;
 		}
 	}
 
@@ -521,458 +707,2044 @@ static CommonError _handleWrite(BurnerOperationDescription *operation, FlashMemo
 }
 
 
-static _U8 crc8_getForByte(_U8 byte, _U8 polynomial, _U8 start) {
-	_U8 remainder = start;
-
-	remainder ^= byte;
+static CommonError _handleWriteFlash(Bootloader *bootloader, FlashMemory *flash, Image *image, BurnerVerifyMode verifyMode, _BOOL differential, Journal *journal) {
+	CommonError ret = COMMON_NO_ERROR;
 
 	{
-		_U8 bit;
+		BurnerPagesProducer   producer            = { 0 };
+		BootloaderWriteQueue *writeQueue          = NULL;
+		_BOOL                 producerInitialized = FALSE;
+		_BOOL                 producerStarted     = FALSE;
+		_U32                 *pagesFill           = NULL;
+		_U8                  *pageBuffer          = NULL;
+		_U16                 *pagesCrc            = NULL;
+		_U16                 *deviceCrc           = NULL;
+		_U16                 *journalCrc          = NULL;
+		_BOOL                 journalCrcRead      = FALSE;
+		_S32                  firstPage           = -1;
+		_S32                  lastPage            = -1;
+		_U32                  pagesCount          = 0;
+		_U32                  pagesSkipped        = 0;
+		_U32                  pagesResumed        = 0;
 
-		for (bit = 0; bit < 8; bit++) {
-			if (remainder & 0x01) {
-				remainder = (remainder >> 1) ^ polynomial;
+		do {
+			_U32 i;
 
-			} else {
-				remainder = (remainder >> 1);
+			pagesFill  = calloc(flash->blocksCount, sizeof(*pagesFill));
+			pagesCrc   = calloc(flash->blocksCount, sizeof(*pagesCrc));
+			pageBuffer = malloc(flash->blockSize * BURNER_PIPELINE_CHUNK_PAGES);
+			if ((pagesFill == NULL) || (pagesCrc == NULL) || (pageBuffer == NULL)) {
+				ERR(("_handleWriteFlash(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
 			}
 
-		}
-	}
+			// Plan pages containing image data
+			for (i = 0; i < image->segmentsCount; i++) {
+				ImageSegment *segment = &image->segments[i];
+				_U32          address;
 
-    return remainder;
-}
+				DBG(("_handleWriteFlash(): Segment at: %d, size: %d", segment->address, segment->size));
+
+				for (address = segment->address; address < segment->address + segment->size; address++) {
+					pagesFill[address / flash->blockSize]++;
+				}
 
+				if (segment->address + segment->size > flash->usedSize) {
+					flash->usedSize = segment->address + segment->size;
+				}
+			}
 
-static _U8 crc8_get(_U8 *buffer, _U16 bufferSize, _U8 polynomial, _U8 start) {
-	_U8  remainder = start;
-	_U16 byte;
+			for (i = 0; i < flash->blocksCount; i++) {
+				if (pagesFill[i] == 0) {
+					continue;
+				}
 
-	// Perform modulo-2 division, a byte at a time.
-	for (byte = 0; byte < bufferSize; byte++) {
-		remainder = crc8_getForByte(buffer[byte], polynomial, remainder);
-	}
+				if (firstPage < 0) {
+					firstPage = i;
+				}
 
-    return remainder;
-}
+				lastPage = i;
 
+				pagesCount++;
 
-static CommonError _handleCommit(FlashMemory *flash) {
-	CommonError ret = COMMON_NO_ERROR;
+				// Keep content of pages partially covered by image
+				if ((pagesFill[i] < flash->blockSize) && ! flash->blocks[i].read) {
+					DBG(("_handleWriteFlash(): Reading %d page.", i));
 
-	do {
-		_U32 i;
+					ret = bootloader_flashPageRead(bootloader, i, flash->blocks[i].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+					if (ret != COMMON_NO_ERROR) {
+						ERR(("_handleWriteFlash(): Error reading from flash!"));
 
-		for (i = 0; i < flash->blocksCount; i++) {
-			if (! flash->blocks[i].read) {
-				ret = bootloader_flashPageRead(i, flash->blocks[i].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
-				if (ret != COMMON_NO_ERROR) {
-					REPORT_ERR(("Unable to read page %d!", i));
+						break;
+					}
 
-					break;
+					flash->blocks[i].read = TRUE;
 				}
-
-				DBG(("Page: %d read.", i));
 			}
-		}
-
-		if (ret != COMMON_NO_ERROR) {
-			break;
-		}
-
-		{
-			_U8  checksum   = crc8_get(flash->buffer, (flash->blocksCount * flash->blockSize) - 1, IMAGE_CHECKSUM_POLYNOMIAL, 0);
-			_U32 pageNumber = flash->blocksCount - 1;
-
-			DBG(("CRC8: %x", checksum));
 
-			flash->blocks[pageNumber].data[flash->blockSize - 1] = checksum;
-
-			ret |= bootloader_flashPageErase(pageNumber, BOOTLOADER_TIMEOUT);
-			ret |= bootloader_flashPageWrite(pageNumber, flash->blocks[pageNumber].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
 			if (ret != COMMON_NO_ERROR) {
-				REPORT_ERR(("Error writing checksum to flash memory!"));
-
 				break;
 			}
-		}
-	} while (0);
-
-	return ret;
-}
-
-
-static void _showUsage(char *fileName) {
-	REPORT(("Usage: "));
-	REPORT((" $ %s [edwiomrc] [--page-start] [--page-end] [--offset] [--size] <inFile/outFile>", fileName));
-	REPORT((" Where:"));
-	REPORT(("  -e [--erase]      erase memory - only for flash."));
-	REPORT(("     [--page-start] first page to erase - default: 0."));
-	REPORT(("     [--page-end]   last page to erase  - default: the last page."));
-	REPORT((" "));
-	REPORT(("  -d [--dump]   dump memory."));
-	REPORT(("     [--offset] start offset in memory - default: 0."));
-	REPORT(("     [--size]   size of memory to dump - default: all writable memory size."));
-	REPORT((" "));
-	REPORT(("  -w [--write]  write memory."));
-	REPORT(("     [--offset] start offset - default: 0."));
-	REPORT((" "));
-	REPORT(("  -i [--in]  input file path."));
-	REPORT(("  -o [--out] output file path."));
-	REPORT((" "));
-	REPORT(("     [--memory-type] Type of memory to read/write. Available are: 'flash' and 'e2prom' - default: 'flash."));
-	REPORT(("     [--reset]       Reset MCU after all operation performed."));
-	REPORT(("     [--commit]      Compute and write checksum of flash memory to allow bootloader start main application."))
-}
 
+			if (pagesCount == 0) {
+				REPORT(("Nothing to write."));
 
-int main(int argc, char *argv[]) {
-	CommonError ret = COMMON_NO_ERROR;
+				break;
+			}
 
-	do {
-		BurnerOperationDescription operation    = { 0 };
-		FlashMemory                flashMemory  = { 0 };
-		E2promMemory               e2promMemory = { 0 };
+			REPORT(("Writing %d pages in range %d - %d.", pagesCount, firstPage, lastPage));
 
-		DBG(("START"));
+			// Page images are prepared in background from now on
+			{
+				producer.flash      = flash;
+				producer.image      = image;
+				producer.pagesFill  = pagesFill;
+				producer.pagesCrc   = pagesCrc;
+				producer.firstPage  = firstPage;
+				producer.lastPage   = lastPage;
+				producer.pagesReady = firstPage;
 
-		operation.type = BURNER_OPERATION_NONE;
+				pthread_mutex_init(&producer.mutex, NULL);
+				pthread_cond_init(&producer.cond, NULL);
 
-		operation.parameters.erase.endPage   = -1;
-		operation.parameters.erase.startPage = -1;
-		operation.parameters.read.size       = -1;
-		operation.parameters.read.offset     = -1;
-		operation.parameters.write.offset    = -1;
+				producerInitialized = TRUE;
 
-		do {
-			struct option longOptions[] = {
-				{ "erase",       no_argument,       NULL, 'e' },
-				{ "page-start",  required_argument, NULL,  1  },
-				{ "page-end",    required_argument, NULL,  2  },
-				{ "dump",        no_argument,       NULL, 'd' },
-				{ "offset",      required_argument, NULL,  3  },
-				{ "size",        required_argument, NULL,  4  },
-				{ "write",       no_argument,       NULL, 'w' },
-				{ "in",          required_argument, NULL, 'i' },
-				{ "out",         required_argument, NULL, 'o' },
-				{ "memory-type", required_argument, NULL, 'm' },
-				{ "reset",       no_argument,       NULL, 'r' },
-				{ "commit",      no_argument,       NULL, 'c' },
-				{ NULL,          0,                 NULL,  0  }
-			};
-			char *shortOptions = "edwi:o:m:rc";
+				if (pthread_create(&producer.thread, NULL, _pagesProducerThread, &producer) == 0) {
+					producerStarted = TRUE;
 
-			bootloader_initialize();
+				} else {
+					DBG(("_handleWriteFlash(): Unable to start producer, preparing pages in place."));
 
-			while (1) {
-				int longOptionIndex = -1;
-				int getOptRet;
+					_pagesProducerThread(&producer);
+				}
+			}
 
-				getOptRet = getopt_long(argc, argv, shortOptions, longOptions, &longOptionIndex);
-				if (getOptRet < 0) {
-					DBG(("all options parsed."));
+			// Get checksums of pages currently programmed to skip unchanged ones
+			if (differential) {
+				deviceCrc = malloc((lastPage - firstPage + 1) * sizeof(*deviceCrc));
+				if (deviceCrc == NULL) {
+					ERR(("_handleWriteFlash(): No more free memory!"));
 
+					ret = COMMON_ERROR_NO_FREE_RESOURCES;
 					break;
 				}
 
-				DBG(("Option: %d, long option index: %d", getOptRet, longOptionIndex));
+				ret = bootloader_flashPagesCrc(bootloader, firstPage, lastPage - firstPage + 1, deviceCrc, BOOTLOADER_TIMEOUT);
+				if (ret != COMMON_NO_ERROR) {
+					if (ret == COMMON_ERROR_NOT_SUPPORTED) {
+						REPORT(("Bootloader does not support page checksums, writing all pages."));
 
-				switch (getOptRet) {
-					case 'e':
-						{
-							if (operation.type != BURNER_OPERATION_NONE) {
-								ret = COMMON_ERROR_BAD_PARAMETER;
+					} else {
+						REPORT(("Unable to read page checksums, writing all pages."));
+					}
 
-								break;
-							}
+					free(deviceCrc);
 
-							operation.type = BURNER_OPERATION_ERASE;
-						}
+					deviceCrc = NULL;
+					ret       = COMMON_NO_ERROR;
+				}
+			}
+
+			// Checksums are read right after each chunk, readback is done by blocking commands
+			if (verifyMode != BURNER_VERIFY_MODE_READBACK) {
+				ret = bootloader_writeQueueOpen(bootloader, BURNER_WRITE_QUEUE_DEPTH, verifyMode == BURNER_VERIFY_MODE_CRC, &writeQueue);
+				if (ret != COMMON_NO_ERROR) {
+					if (ret != COMMON_ERROR_NOT_SUPPORTED) {
 						break;
+					}
 
-					case 'd':
-						{
-							if (operation.type != BURNER_OPERATION_NONE) {
-								ret = COMMON_ERROR_BAD_PARAMETER;
+					DBG(("_handleWriteFlash(): Bootloader can not queue writes, each chunk is verified before the next is sent."));
 
-								break;
-							}
+					ret = COMMON_NO_ERROR;
+				}
+			}
 
-							operation.type = BURNER_OPERATION_READ;
-						}
-						break;
+			// Write chunks of consecutive pages, queued ones are sent while device programs previous ones
+			i = firstPage;
 
-					case 'w':
-						{
-							if (operation.type != BURNER_OPERATION_NONE) {
-								ret = COMMON_ERROR_BAD_PARAMETER;
+			while (i <= lastPage) {
+				_U32 chunkEnd = i;
 
-								break;
-							}
+				_pagesProducerWait(&producer, i);
 
-							operation.type = BURNER_OPERATION_WRITE;
-						}
-						break;
+				if (pagesFill[i] == 0) {
+					i++;
+					continue;
+				}
 
-					case 'i':
-						{
-							if (operation.path.input[0] != '\0') {
-								ret = COMMON_ERROR_BAD_PARAMETER;
+				if ((deviceCrc != NULL) && (deviceCrc[i - firstPage] == pagesCrc[i])) {
+					REPORT(("Page %d unchanged, skipping.", i));
 
-								break;
-							}
+					flash->blocks[i].read = TRUE;
 
-							strncpy(operation.path.input, optarg, sizeof(operation.path.input));
-						}
-						break;
+					pagesSkipped++;
+					i++;
+					continue;
+				}
 
-					case 'o':
-						{
-							if (operation.path.output[0] != '\0') {
-								ret = COMMON_ERROR_BAD_PARAMETER;
+				if (_journalPageDone(bootloader, flash, journal, i, firstPage, lastPage, pagesCrc, &journalCrc, &journalCrcRead)) {
+					REPORT(("Page %d written by previous run, skipping.", i));
 
-								break;
-							}
+					flash->blocks[i].read = TRUE;
 
-							strncpy(operation.path.output, optarg, sizeof(operation.path.output));
-						}
-						break;
+					pagesResumed++;
+					i++;
+					continue;
+				}
 
-					case 'm':
-						{
-							if (operation.memoryType != BURNER_MEMORY_TYPE_NONE) {
-								ret = COMMON_ERROR_BAD_PARAMETER;
+				while ((chunkEnd <= lastPage) && (chunkEnd - i < BURNER_PIPELINE_CHUNK_PAGES)) {
+					_pagesProducerWait(&producer, chunkEnd);
 
-								break;
-							}
+					if ((pagesFill[chunkEnd] == 0) || ((deviceCrc != NULL) && (deviceCrc[chunkEnd - firstPage] == pagesCrc[chunkEnd]))) {
+						break;
+					}
 
-							if (strcasecmp("flash", optarg) == 0) {
-								operation.memoryType = BURNER_MEMORY_TYPE_FLASH;
+					if (_journalPageDone(bootloader, flash, journal, chunkEnd, firstPage, lastPage, pagesCrc, &journalCrc, &journalCrcRead)) {
+						break;
+					}
 
-							} else if (strcasecmp("e2prom", optarg) == 0) {
-								operation.memoryType = BURNER_MEMORY_TYPE_E2PROM;
+					chunkEnd++;
+				}
 
-							} else {
-								REPORT_ERR(("Not supported memory type '%s'! Supported are only: flash|e2prom", optarg));
+				REPORT(("Writing pages  %d - %d.", i, chunkEnd - 1));
 
-								ret = COMMON_ERROR_BAD_PARAMETER;
-							}
-						}
+				if (writeQueue != NULL) {
+					ret = _reapWrittenPages(writeQueue, flash, verifyMode, pagesCrc, journal, BURNER_WRITE_QUEUE_DEPTH - 1);
+					if (ret != COMMON_NO_ERROR) {
 						break;
+					}
 
-					case 'r':
-						{
-							operation.reset = TRUE;
-						}
-						break;
+					ret = bootloader_writeQueueSubmit(writeQueue, i, chunkEnd - i, flash->blocks[i].data, TRUE, BOOTLOADER_TIMEOUT);
+					if (ret != COMMON_NO_ERROR) {
+						REPORT_ERR(("Unable to write pages %d - %d!", i, chunkEnd - 1));
 
-					case 'c':
-						{
-							operation.commit = TRUE;
-						}
 						break;
+					}
 
-					case 1:
-						{
-							operation.parameters.erase.startPage = atoi(optarg);
-						}
-						break;
+					i = chunkEnd;
+					continue;
+				}
 
-					case 2:
-						{
-							operation.parameters.erase.endPage = atoi(optarg);
-						}
-						break;
+				ret = bootloader_flashPagesWrite(bootloader, i, chunkEnd - i, flash->blocks[i].data, TRUE, BOOTLOADER_TIMEOUT);
+				if (ret != COMMON_NO_ERROR) {
+					REPORT_ERR(("Unable to write pages %d - %d!", i, chunkEnd - 1));
 
-					case 3:
-						{
-							operation.parameters.read.offset  = atoi(optarg);
-							operation.parameters.write.offset = atoi(optarg);
-						}
-						break;
+					break;
+				}
 
-					case 4:
-						{
-							operation.parameters.read.size = atoi(optarg);
-						}
-						break;
+				ret = _verifyFlashPages(bootloader, flash, i, chunkEnd - i, verifyMode, pagesCrc, pageBuffer);
+				if (ret != COMMON_NO_ERROR) {
+					break;
+				}
 
-					case '?':
-						ret = COMMON_ERROR_BAD_PARAMETER;
+				// Pages which were not verified are not trusted by next run
+				if ((journal != NULL) && (verifyMode != BURNER_VERIFY_MODE_NONE)) {
+					ret = journal_pagesDone(journal, i, chunkEnd - i, &pagesCrc[i]);
+					if (ret != COMMON_NO_ERROR) {
 						break;
+					}
+				}
 
-					default:
-						break;
+				if (verifyMode == BURNER_VERIFY_MODE_NONE) {
+					REPORT(("Pages %d - %d have written.", i, chunkEnd - 1));
+
+				} else {
+					REPORT(("Pages %d - %d have written and verified.", i, chunkEnd - 1));
+				}
+
+				while (i < chunkEnd) {
+					flash->blocks[i].read = TRUE;
+
+					i++;
 				}
 			}
 
-			if (operation.type == BURNER_OPERATION_NONE) {
-				ret = COMMON_ERROR_BAD_PARAMETER;
+			if ((ret == COMMON_NO_ERROR) && (writeQueue != NULL)) {
+				ret = _reapWrittenPages(writeQueue, flash, verifyMode, pagesCrc, journal, 0);
 			}
 
-			if (ret != COMMON_NO_ERROR) {
-				_showUsage(argv[0]);
+			if (deviceCrc != NULL) {
+				REPORT(("%d of %d pages skipped.", pagesSkipped, pagesCount));
+			}
 
-				break;
+			if (pagesResumed > 0) {
+				REPORT(("%d of %d pages written by previous run.", pagesResumed, pagesCount));
 			}
+
+			_reportFlashWork(bootloader);
 		} while (0);
 
+		// Transfers still in flight use page images
+		bootloader_writeQueueClose(writeQueue);
+
+		// Flash map has to be complete also when writing was interrupted
+		if (producerStarted) {
+			pthread_join(producer.thread, NULL);
+		}
+
+		if (producerInitialized) {
+			pthread_cond_destroy(&producer.cond);
+			pthread_mutex_destroy(&producer.mutex);
+		}
+
+		if (deviceCrc != NULL) {
+			free(deviceCrc);
+		}
+
+		if (journalCrc != NULL) {
+			free(journalCrc);
+		}
+
+		if (pagesCrc != NULL) {
+			free(pagesCrc);
+		}
+
+		if (pageBuffer != NULL) {
+			free(pageBuffer);
+		}
+
+		if (pagesFill != NULL) {
+			free(pagesFill);
+		}
+	}
+
+	return ret;
+}
+
+
+static CommonError _handleWriteE2prom(Bootloader *bootloader, E2promMemory *e2prom, _U32 offset, _U8 *buffer, _U32 bufferSize) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		REPORT(("Writing %d bytes to e2prom at offset: %d", bufferSize, offset));
+
+		ret = bootloader_e2promWrite(bootloader, offset, buffer, bufferSize, BOOTLOADER_TIMEOUT, NULL);
 		if (ret != COMMON_NO_ERROR) {
-			break;
+			REPORT_ERR(("Unable to write e2prom memory!"));
 		}
+	}
 
-		REPORT(("Connecting..."));
+	return ret;
+}
 
-		{
-			BootloaderTargetInformation targetInformation = { 0 };
 
-			// Try connect to target
-			ret = bootloader_connect(&targetInformation, BOOTLOADER_TIMEOUT);
+static CommonError _handleWrite(Bootloader *bootloader, const char *deviceId, BurnerOperationDescription *operation, FlashMemory *flash, E2promMemory *e2prom) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		Image    image   = { 0 };
+		Journal *journal = NULL;
+
+		do {
+			_U32 memorySize;
+			_U32 i;
+
+			ret = image_load(
+				operation->path.input,
+				operation->parameters.write.offset,
+				(operation->memoryType == BURNER_MEMORY_TYPE_E2PROM) ? IMAGE_MEMORY_E2PROM : IMAGE_MEMORY_FLASH,
+				&image
+			);
 			if (ret != COMMON_NO_ERROR) {
-				REPORT_ERR(("No device with active bootloader found!"));
+				REPORT_ERR(("Unable to load input file!"));
 
-				ret = COMMON_ERROR_NO_DEVICE;
 				break;
 			}
 
-			REPORT(("Found MCU '%s' with bootloader version: %d.%d.",
-				targetInformation.mcu.name, targetInformation.bootloader.versionMajor, targetInformation.bootloader.versionMinor
-			));
+			if (operation->memoryType == BURNER_MEMORY_TYPE_FLASH) {
+				// Prereserve memory for image header
+				memorySize = flash->blockSize * flash->blocksCount - IMAGE_HEADER_SIZE;
 
-			REPORT(("MCU flash size: %d (%d pages), page size: %d, e2prom size: %d",
-				targetInformation.flash.pageSize * targetInformation.flash.pagesCount, targetInformation.flash.pagesCount,
-				targetInformation.flash.pageSize, targetInformation.e2prom.size
-			));
+			} else {
+				memorySize = e2prom->size;
+			}
 
-			// Set default memory type
-			if (operation.memoryType == BURNER_MEMORY_TYPE_NONE) {
-				operation.memoryType = BURNER_MEMORY_TYPE_FLASH;
+			for (i = 0; i < image.segmentsCount; i++) {
+				if ((image.segments[i].size > memorySize) || (image.segments[i].address > memorySize - image.segments[i].size)) {
+					REPORT_ERR(("Input file doesn't fit into memory!"));
+
+					ret = COMMON_ERROR;
+					break;
+				}
 			}
 
-			// Allocate structure for flash memory blocks
-			if (operation.memoryType == BURNER_MEMORY_TYPE_FLASH) {
-				_U32 i;
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
 
-				flashMemory.blockSize   = targetInformation.flash.pageSize;
-				flashMemory.blocksCount = targetInformation.flash.pagesCount;
+			/*
+			 * Journal is kept per device, so concurrently flashed devices have separate ones.
+			 * Device id is its bus address, a device which got another address after
+			 * reconnection does not find its journal and all pages are written again.
+			 */
+			if (operation->resume && (operation->memoryType == BURNER_MEMORY_TYPE_FLASH)) {
+				char journalPath[PATH_LENGTH_MAX + BOOTLOADER_DEVICE_ID_LENGTH_MAX];
 
-				flashMemory.blocks = malloc(flashMemory.blocksCount * sizeof(FlashMemoryBlock));
-				if (flashMemory.blocks == NULL) {
-					ERR(("main(): Unable to allocate memory!"));
+				if (operation->path.journal[0] != '\0') {
+					snprintf(journalPath, sizeof(journalPath), "%s", operation->path.journal);
 
-					ret = COMMON_ERROR_NO_FREE_RESOURCES;
-					break;
+				} else {
+					snprintf(journalPath, sizeof(journalPath), "%s.journal", operation->path.input);
 				}
 
-				flashMemory.buffer = malloc(flashMemory.blockSize * flashMemory.blocksCount);
-				if (flashMemory.buffer == NULL) {
-					ERR(("main(): Unable to allocate memory!"));
+				if (deviceId != NULL) {
+					char *ptr = journalPath + strlen(journalPath);
 
-					ret = COMMON_ERROR_NO_FREE_RESOURCES;
+					snprintf(ptr, sizeof(journalPath) - (ptr - journalPath), ".%s", deviceId);
+
+					// Keep file name free of ':'
+					while ((ptr = strchr(ptr, ':')) != NULL) {
+						*ptr = '-';
+					}
+				}
+
+				ret = journal_open(&journal, journalPath, journal_imageHash(&image));
+				if (ret != COMMON_NO_ERROR) {
 					break;
 				}
+			}
 
-				memset(flashMemory.buffer, 0, flashMemory.blockSize * flashMemory.blocksCount);
+			if (operation->memoryType == BURNER_MEMORY_TYPE_FLASH) {
+				ret = _handleWriteFlash(bootloader, flash, &image, operation->verifyMode, operation->differential, journal);
 
-				for (i = 0; i < flashMemory.blocksCount; i++) {
-					flashMemory.blocks[i].read = FALSE;
-					flashMemory.blocks[i].data = flashMemory.buffer + i * flashMemory.blockSize;
+			} else {
+				for (i = 0; i < image.segmentsCount; i++) {
+					ret = _handleWriteE2prom(bootloader, e2prom, image.segments[i].address, image.segments[i].data, image.segments[i].size);
+					if (ret != COMMON_NO_ERROR) {
+						break;
+					}
 				}
+			}
+			if (ret != COMMON_NO_ERROR) {
+				REPORT_ERR(("Error writing input file to '%s' memory!.", operation->memoryType == BURNER_MEMORY_TYPE_FLASH ? "flash" : "e2prom"));
 
-			// Allocate memory for e2prom map
-			} else {
-				e2promMemory.size = targetInformation.e2prom.size;
+				break;
+			}
+		} while (0);
 
-				e2promMemory.buffer = malloc(e2promMemory.size);
-				if (e2promMemory.buffer == NULL) {
-					ERR(("main(): Unable to allocate memory!"));
+		// Journal is needed only to resume interrupted write
+		if (journal != NULL) {
+			journal_close(journal, ret == COMMON_NO_ERROR);
+		}
 
-					ret = COMMON_ERROR_NO_FREE_RESOURCES;
-					break;
-				}
+		image_free(&image);
+	}
+
+	return ret;
+}
+
+
+/*
+ * Continues checksum over flash bytes in range [from, to). Pages known to
+ * the host are checksummed locally, runs of the other whole pages by the
+ * bootloader. Partially covered unknown pages are read.
+ */
+static CommonError _flashChecksum(Bootloader *bootloader, FlashMemory *flash, _U32 from, _U32 to, _U8 *checksum) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		_U32 address = from;
+
+		while (address < to) {
+			_U32 page      = address / flash->blockSize;
+			_U32 pageStart = page * flash->blockSize;
+			_U32 pageEnd   = pageStart + flash->blockSize;
+
+			if (pageEnd > to) {
+				pageEnd = to;
 			}
 
-			// Perform operation
-			switch (operation.type) {
-				case BURNER_OPERATION_ERASE:
-					{
-						if (operation.parameters.erase.startPage < 0) {
-							operation.parameters.erase.startPage = 0;
-						}
+			if (flash->blocks[page].read) {
+				*checksum = crc8_get(flash->buffer + address, pageEnd - address, *checksum);
 
-						if (operation.parameters.erase.endPage < 0) {
-							operation.parameters.erase.endPage = targetInformation.flash.pagesCount - 1;
-						}
+				address = pageEnd;
+				continue;
+			}
+
+			if ((address != pageStart) || (pageEnd != pageStart + flash->blockSize)) {
+				ret = bootloader_flashPageRead(bootloader, page, flash->blocks[page].data, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+				if (ret != COMMON_NO_ERROR) {
+					REPORT_ERR(("Unable to read page %d!", page));
 
-						ret = _handleErase(&operation, &flashMemory, &e2promMemory);
-					}
 					break;
+				}
 
-				case BURNER_OPERATION_READ:
-					{
-						// Set default parameters if needed
-						{
-							if (operation.parameters.read.offset < 0) {
-								operation.parameters.read.offset = 0;
-							}
+				flash->blocks[page].read = TRUE;
+				continue;
+			}
+
+			// Let the bootloader compute checksum of whole pages unknown to the host
+			{
+				_U32 runEnd = page;
 
-							if (operation.parameters.read.size < 0) {
-								if (operation.memoryType == BURNER_MEMORY_TYPE_FLASH) {
-									operation.parameters.read.size = targetInformation.flash.pageSize * targetInformation.flash.pagesCount;
+				while (
+					((runEnd + 1) * flash->blockSize <= to) &&
+					(! flash->blocks[runEnd].read) &&
+					(runEnd - page < 0xff)
+				) {
+					runEnd++;
+				}
 
-								} else {
-									operation.parameters.read.size = targetInformation.e2prom.size;
-								}
-							}
-						}
+				ret = bootloader_flashCrc(bootloader, page, runEnd - page, *checksum, checksum, BOOTLOADER_TIMEOUT);
+				if (ret == COMMON_NO_ERROR) {
+					DBG(("Pages: %d - %d checksum computed by bootloader.", page, runEnd - 1));
+
+					address = runEnd * flash->blockSize;
 
-						ret = _handleRead(&operation, &flashMemory, &e2promMemory);
+				} else if (ret == COMMON_ERROR_NOT_SUPPORTED) {
+					ret = bootloader_flashPagesRead(bootloader, page, runEnd - page, flash->blocks[page].data, BOOTLOADER_TIMEOUT);
+					if (ret != COMMON_NO_ERROR) {
+						REPORT_ERR(("Unable to read pages %d - %d!", page, runEnd - 1));
+
+						break;
 					}
-					break;
 
-				case BURNER_OPERATION_WRITE:
-					{
-						// Set default parameters if needed
-						if (operation.parameters.write.offset < 0) {
-							operation.parameters.write.offset = 0;
-						}
+					DBG(("Pages: %d - %d read.", page, runEnd - 1));
+
+					// Pages are checksummed by host in next iterations
+					while (runEnd > page) {
+						runEnd--;
 
-						ret = _handleWrite(&operation, &flashMemory, &e2promMemory);
+						flash->blocks[runEnd].read = TRUE;
 					}
-					break;
 
-				default:
+				} else {
+					REPORT_ERR(("Unable to compute checksum of pages %d - %d!", page, runEnd - 1));
+
 					break;
+				}
 			}
-			if (ret != COMMON_NO_ERROR) {
-				REPORT_ERR(("Operation failed!"));
+		}
+	}
+
+	return ret;
+}
+
 
+/*
+ * Finds end of programmed data when no image was written in this run. Blank
+ * pages at the end of application area are detected by their checksums.
+ */
+static _U32 _flashGetUsedSize(Bootloader *bootloader, FlashMemory *flash) {
+	_U32 ret = flash->blockSize * flash->blocksCount - IMAGE_HEADER_SIZE;
+
+	do {
+		_U16 *pagesCrc = NULL;
+		_U16  blankCrc;
+		_U8  *blankPage;
+		_S32  i;
+
+		if (flash->usedSize > 0) {
+			ret = flash->usedSize;
+			break;
+		}
+
+		// Last page is already read, image data there means whole area is used
+		for (i = 0; i < flash->blockSize - IMAGE_HEADER_SIZE; i++) {
+			if (flash->blocks[flash->blocksCount - 1].data[i] != 0xff) {
 				break;
 			}
+		}
 
-			if (operation.commit) {
-				ret = _handleCommit(&flashMemory);
-				if (ret != COMMON_NO_ERROR) {
-					REPORT_ERR(("Unable to write flash checksum!"));
+		if (i < flash->blockSize - IMAGE_HEADER_SIZE) {
+			break;
+		}
 
-					break;
+		pagesCrc  = malloc(flash->blocksCount * sizeof(*pagesCrc));
+		blankPage = malloc(flash->blockSize);
+
+		if ((pagesCrc != NULL) && (blankPage != NULL)) {
+			memset(blankPage, 0xff, flash->blockSize);
+
+			blankCrc = crc16_get(blankPage, flash->blockSize, PAGE_CHECKSUM_INITIAL);
+
+			if (bootloader_flashPagesCrc(bootloader, 0, flash->blocksCount - 1, pagesCrc, BOOTLOADER_TIMEOUT) == COMMON_NO_ERROR) {
+				for (i = flash->blocksCount - 2; i >= 0; i--) {
+					if (pagesCrc[i] != blankCrc) {
+						break;
+					}
 				}
+
+				ret = (i + 1) * flash->blockSize;
 			}
 		}
 
-		if (e2promMemory.buffer != NULL) {
-			free(e2promMemory.buffer);
+		free(pagesCrc);
+		free(blankPage);
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _handleCommit(Bootloader *bootloader, FlashMemory *flash) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		_U32 lastPage     = flash->blocksCount - 1;
+		_U8 *lastPageData = flash->blocks[lastPage].data;
+		_U32 headerStart  = flash->blockSize * flash->blocksCount - IMAGE_HEADER_SIZE;
+		_U32 usedSize;
+		_U8  checksum     = 0;
+
+		// The last page is rewritten with header, so its content is always needed
+		if (! flash->blocks[lastPage].read) {
+			ret = bootloader_flashPageRead(bootloader, lastPage, lastPageData, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+			if (ret != COMMON_NO_ERROR) {
+				REPORT_ERR(("Unable to read page %d!", lastPage));
+
+				break;
+			}
+
+			flash->blocks[lastPage].read = TRUE;
 		}
 
-		if (flashMemory.buffer != NULL) {
-			free(flashMemory.buffer);
+		usedSize = _flashGetUsedSize(bootloader, flash);
+		if (usedSize > headerStart) {
+			usedSize = headerStart;
 		}
 
-		if (flashMemory.blocks != NULL) {
-			free(flashMemory.blocks);
+		REPORT(("Image size: %d bytes.", usedSize));
+
+		lastPageData[flash->blockSize - IMAGE_HEADER_OFFSET_MAGIC]      = IMAGE_HEADER_MAGIC;
+		lastPageData[flash->blockSize - IMAGE_HEADER_OFFSET_LENGTH]     = usedSize & 0xff;
+		lastPageData[flash->blockSize - IMAGE_HEADER_OFFSET_LENGTH + 1] = usedSize >> 8;
+
+		// Checksum of used image, continued over header
+		ret = _flashChecksum(bootloader, flash, 0, usedSize, &checksum);
+		if (ret != COMMON_NO_ERROR) {
+			break;
+		}
+
+		lastPageData[flash->blockSize - IMAGE_HEADER_OFFSET_CHECKSUM] = crc8_get(lastPageData + flash->blockSize - IMAGE_HEADER_OFFSET_MAGIC, IMAGE_HEADER_OFFSET_MAGIC - IMAGE_HEADER_OFFSET_CHECKSUM, checksum);
+
+		// Checksum of whole application area for bootloaders without header support
+		ret = _flashChecksum(bootloader, flash, usedSize, flash->blockSize * flash->blocksCount - 1, &checksum);
+		if (ret != COMMON_NO_ERROR) {
+			break;
+		}
+
+		DBG(("CRC8: %x", checksum));
+
+		lastPageData[flash->blockSize - 1] = checksum;
+
+		ret = bootloader_flashPageEraseWrite(bootloader, lastPage, lastPageData, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+		if (ret != COMMON_NO_ERROR) {
+			REPORT_ERR(("Error writing checksum to flash memory!"));
+
+			break;
 		}
 	} while (0);
 
+	return ret;
+}
+
+
+static void _operationInitialize(BurnerOperationDescription *operation) {
+	memset(operation, 0, sizeof(*operation));
+
+	operation->type = BURNER_OPERATION_NONE;
+
+	operation->parameters.erase.endPage   = -1;
+	operation->parameters.erase.startPage = -1;
+	operation->parameters.read.size       = -1;
+	operation->parameters.read.offset     = -1;
+	operation->parameters.write.offset    = -1;
+}
+
+
+// Every verb starts a new operation, options which follow it are its parameters
+static CommonError _sessionAddOperation(BurnerSession *session, BurnerOperationType type) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		BurnerOperationDescription *operation = &session->operations[session->operationsCount - 1];
+
+		if (operation->type != BURNER_OPERATION_NONE) {
+			if (session->operationsCount == BURNER_OPERATIONS_MAX) {
+				REPORT_ERR(("Too many operations, up to %d are supported!", BURNER_OPERATIONS_MAX));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			operation = &session->operations[session->operationsCount++];
+
+			_operationInitialize(operation);
+		}
+
+		operation->type = type;
+	} while (0);
+
+	return ret;
+}
+
+
+static char *_readScript(const char *path) {
+	char *ret = NULL;
+
+	{
+		_S32 file = open(path, O_RDONLY);
+
+		do {
+			struct stat stats = { 0 };
+
+			if (file < 0) {
+				REPORT_ERR(("Unable to open script file '%s'! (%m)", path));
+
+				break;
+			}
+
+			if (fstat(file, &stats) < 0) {
+				REPORT_ERR(("Unable to stat script file '%s'! (%m)", path));
+
+				break;
+			}
+
+			ret = malloc(stats.st_size + 1);
+			if (ret == NULL) {
+				ERR(("_readScript(): No more free memory!"));
+
+				break;
+			}
+
+			if (read(file, ret, stats.st_size) != stats.st_size) {
+				REPORT_ERR(("Error reading script file '%s'! (%m)", path));
+
+				free(ret);
+
+				ret = NULL;
+				break;
+			}
+
+			ret[stats.st_size] = '\0';
+		} while (0);
+
+		if (file >= 0) {
+			close(file);
+		}
+	}
+
+	return ret;
+}
+
+
+/*
+ * Replaces every '--script <file>' (or '--script=<file>') argument with
+ * options read from the file. Options are separated by white spaces, text
+ * from '#' to the end of line is a comment.
+ */
+static CommonError _loadScripts(int *argc, char ***argv) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		char **arguments      = NULL;
+		int    argumentsCount = 0;
+
+		do {
+			int i;
+
+			arguments = malloc((BURNER_SCRIPT_ARGUMENTS_MAX + 1) * sizeof(char *));
+			if (arguments == NULL) {
+				ERR(("_loadScripts(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			for (i = 0; (i < *argc) && (ret == COMMON_NO_ERROR); i++) {
+				const char *path = NULL;
+				char       *text;
+				char       *token;
+				char       *savePtr = NULL;
+
+				if (strncmp((*argv)[i], "--script=", 9) == 0) {
+					path = (*argv)[i] + 9;
+
+				} else if ((strcmp((*argv)[i], "--script") == 0) && (i + 1 < *argc)) {
+					path = (*argv)[++i];
+				}
+
+				if (path == NULL) {
+					if (argumentsCount == BURNER_SCRIPT_ARGUMENTS_MAX) {
+						REPORT_ERR(("Too many arguments, up to %d are supported!", BURNER_SCRIPT_ARGUMENTS_MAX));
+
+						ret = COMMON_ERROR_BAD_PARAMETER;
+						break;
+					}
+
+					arguments[argumentsCount++] = (*argv)[i];
+					continue;
+				}
+
+				// Text is kept until exit, arguments point into it
+				text = _readScript(path);
+				if (text == NULL) {
+					ret = COMMON_ERROR_BAD_PARAMETER;
+					break;
+				}
+
+				// Strip comments
+				{
+					char *comment = text;
+
+					while ((comment = strchr(comment, '#')) != NULL) {
+						while ((*comment != '\0') && (*comment != '\n')) {
+							*comment++ = ' ';
+						}
+					}
+				}
+
+				for (token = strtok_r(text, " \t\r\n", &savePtr); token != NULL; token = strtok_r(NULL, " \t\r\n", &savePtr)) {
+					if (argumentsCount == BURNER_SCRIPT_ARGUMENTS_MAX) {
+						REPORT_ERR(("Too many arguments, up to %d are supported!", BURNER_SCRIPT_ARGUMENTS_MAX));
+
+						ret = COMMON_ERROR_BAD_PARAMETER;
+						break;
+					}
+
+					arguments[argumentsCount++] = token;
+				}
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			arguments[argumentsCount] = NULL;
+
+			*argc = argumentsCount;
+			*argv = arguments;
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (arguments != NULL) {
+				free(arguments);
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+static void _showUsage(char *fileName) {
+	REPORT(("Usage: "));
+	REPORT((" $ %s [edwiomrc] [--page-start] [--page-end] [--offset] [--size] <inFile/outFile>", fileName));
+	REPORT((" Where:"));
+	REPORT(("  -e [--erase]      erase memory - only for flash."));
+	REPORT(("     [--page-start] first page to erase - default: 0."));
+	REPORT(("     [--page-end]   last page to erase  - default: the last page."));
+	REPORT((" "));
+	REPORT(("  -d [--dump]   dump memory."));
+	REPORT(("     [--offset] start offset in memory - default: 0."));
+	REPORT(("     [--size]   size of memory to dump - default: all writable memory size."));
+	REPORT((" "));
+	REPORT(("  -w [--write]  write memory from raw binary, Intel HEX or ELF file."));
+	REPORT(("     [--offset] start offset of raw binary - default: 0."));
+	REPORT((" "));
+	REPORT(("  -i [--in]  input file path."));
+	REPORT(("  -o [--out] output file path."));
+	REPORT((" "));
+	REPORT(("     [--memory-type] Type of memory to read/write. Available are: 'flash' and 'e2prom' - default: 'flash."));
+	REPORT(("     [--reset]       Reset MCU after all operation performed."));
+	REPORT(("     [--commit]      Compute and write checksum of flash memory to allow bootloader start main application."));
+	REPORT(("     [--verify]      Verification of written flash pages. Available are: 'crc', 'readback' and 'none' - default: 'crc'."));
+	REPORT(("     [--diff]        Write only flash pages which differ from the ones already programmed."));
+	REPORT(("     [--simulator]   Use simulated devices instead of USB ones. Optional argument is a comma separated list of files keeping flash and e2prom content between runs, one device per file."));
+	REPORT(("     [--all]         Process all attached devices concurrently."));
+	REPORT(("     [--device]      Process device at <bus>:<address>, can be given multiple times."));
+	REPORT(("     [--script]      Read options from file, '#' starts a comment."));
+	REPORT(("     [--daemon]      Keep device connected and serve requests on given unix socket."));
+	REPORT(("     [--connect]     Send request to daemon listening on given unix socket."));
+	REPORT(("     [--resume]      Record written flash pages in journal and skip the ones recorded by interrupted run. Optional argument is journal path - default: '<inFile>.journal'. Journal of device selected by --device or --all is named after its <bus>:<address>, it is not found after device gets another address."));
+	REPORT(("     [--cache]       Keep last known flash content of device to avoid reading it back. Optional argument is cache directory - default: '~/.cache/jboot'. Cache is identified by MCU and checksum of image committed to the device."));
+	REPORT(("     [--stats]       Print latency of bootloader commands, throughput and device counters, optional argument 'json' selects machine readable format."));
+	REPORT(("     [--stats-file]  Write statistics to given file instead of standard output. JSON statistics of all devices form one array."));
+	REPORT((" "));
+	REPORT((" Verbs (-e, -d, -w) can be repeated, each one starts an operation taking options which follow it."));
+	REPORT((" All operations are performed over one connection, then commit and reset are done, e.g.:"));
+	REPORT(("  $ %s -e --page-start 0 --page-end 10 -w -i app.hex -w -m e2prom -i e2prom.bin -c -r", fileName));
+	REPORT((" "));
+	REPORT((" Daemon holds connection between requests and reconnects after reset, e.g.:"));
+	REPORT(("  $ %s --daemon /tmp/burner.sock &", fileName));
+	REPORT(("  $ %s --connect /tmp/burner.sock -w -i app.hex -c -r", fileName));
+}
+
+
+static CommonError _handleOperation(Bootloader *bootloader, const char *deviceId, BootloaderTargetInformation *targetInformation, BurnerOperationDescription *operationDescription, FlashMemory *flashMemory, E2promMemory *e2promMemory) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		// Defaults are resolved per device, so every device works on its own copy
+		BurnerOperationDescription operation = *operationDescription;
+
+		// Set default memory type
+		if (operation.memoryType == BURNER_MEMORY_TYPE_NONE) {
+			operation.memoryType = BURNER_MEMORY_TYPE_FLASH;
+		}
+
+		switch (operation.type) {
+			case BURNER_OPERATION_ERASE:
+				{
+					if (operation.parameters.erase.startPage < 0) {
+						operation.parameters.erase.startPage = 0;
+					}
+
+					if (operation.parameters.erase.endPage < 0) {
+						operation.parameters.erase.endPage = targetInformation->flash.pagesCount - 1;
+					}
+
+					ret = _handleErase(bootloader, &operation, flashMemory, e2promMemory);
+				}
+				break;
+
+			case BURNER_OPERATION_READ:
+				{
+					// Set default parameters if needed
+					{
+						if (operation.parameters.read.offset < 0) {
+							operation.parameters.read.offset = 0;
+						}
+
+						if (operation.parameters.read.size < 0) {
+							if (operation.memoryType == BURNER_MEMORY_TYPE_FLASH) {
+								operation.parameters.read.size = targetInformation->flash.pageSize * targetInformation->flash.pagesCount;
+
+							} else {
+								operation.parameters.read.size = targetInformation->e2prom.size;
+							}
+						}
+					}
+
+					ret = _handleRead(bootloader, &operation, flashMemory, e2promMemory);
+				}
+				break;
+
+			case BURNER_OPERATION_WRITE:
+				{
+					// Set default parameters if needed
+					if (operation.parameters.write.offset < 0) {
+						operation.parameters.write.offset = 0;
+					}
+
+					ret = _handleWrite(bootloader, deviceId, &operation, flashMemory, e2promMemory);
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return ret;
+}
+
+
+static CommonError _parseOptions(int argc, char *argv[], BurnerOptions *options) {
+	CommonError                 ret       = COMMON_NO_ERROR;
+	BurnerOperationDescription *operation = NULL;
+
+	memset(options, 0, sizeof(*options));
+
+	options->transport  = BOOTLOADER_TRANSPORT_LIBUSB;
+	options->verifyMode = BURNER_VERIFY_MODE_CRC;
+
+	// Options given before the first verb belong to the first operation
+	options->session.operationsCount = 1;
+
+	operation = &options->session.operations[0];
+
+	_operationInitialize(operation);
+
+	// Parsing may be repeated, getopt state has to be reinitialized
+	optind = 0;
+
+	do {
+		struct option longOptions[] = {
+			{ "erase",       no_argument,       NULL, 'e' },
+			{ "page-start",  required_argument, NULL,  1  },
+			{ "page-end",    required_argument, NULL,  2  },
+			{ "dump",        no_argument,       NULL, 'd' },
+			{ "offset",      required_argument, NULL,  3  },
+			{ "size",        required_argument, NULL,  4  },
+			{ "write",       no_argument,       NULL, 'w' },
+			{ "in",          required_argument, NULL, 'i' },
+			{ "out",         required_argument, NULL, 'o' },
+			{ "memory-type", required_argument, NULL, 'm' },
+			{ "reset",       no_argument,       NULL, 'r' },
+			{ "commit",      no_argument,       NULL, 'c' },
+			{ "verify",      required_argument, NULL,  5  },
+			{ "diff",        no_argument,       NULL,  6  },
+			{ "simulator",   optional_argument, NULL,  7  },
+			{ "all",         no_argument,       NULL,  8  },
+			{ "device",      required_argument, NULL,  9  },
+			{ "daemon",      required_argument, NULL, 10  },
+			{ "connect",     required_argument, NULL, 11  },
+			{ "stats",       optional_argument, NULL, 12  },
+			{ "resume",      optional_argument, NULL, 13  },
+			{ "cache",       optional_argument, NULL, 14  },
+			{ "stats-file",  required_argument, NULL, 15  },
+			{ NULL,          0,                 NULL,  0  }
+		};
+		char *shortOptions = "edwi:o:m:rc";
+
+		while (1) {
+			int longOptionIndex = -1;
+			int getOptRet;
+
+			getOptRet = getopt_long(argc, argv, shortOptions, longOptions, &longOptionIndex);
+			if (getOptRet < 0) {
+				DBG(("all options parsed."));
+
+				break;
+			}
+
+			DBG(("Option: %d, long option index: %d", getOptRet, longOptionIndex));
+
+			switch (getOptRet) {
+				case 'e':
+					{
+						ret = _sessionAddOperation(&options->session, BURNER_OPERATION_ERASE);
+
+						operation = &options->session.operations[options->session.operationsCount - 1];
+					}
+					break;
+
+				case 'd':
+					{
+						ret = _sessionAddOperation(&options->session, BURNER_OPERATION_READ);
+
+						operation = &options->session.operations[options->session.operationsCount - 1];
+					}
+					break;
+
+				case 'w':
+					{
+						ret = _sessionAddOperation(&options->session, BURNER_OPERATION_WRITE);
+
+						operation = &options->session.operations[options->session.operationsCount - 1];
+					}
+					break;
+
+				case 'i':
+					{
+						if (operation->path.input[0] != '\0') {
+							ret = COMMON_ERROR_BAD_PARAMETER;
+
+							break;
+						}
+
+						strncpy(operation->path.input, optarg, sizeof(operation->path.input));
+					}
+					break;
+
+				case 'o':
+					{
+						if (operation->path.output[0] != '\0') {
+							ret = COMMON_ERROR_BAD_PARAMETER;
+
+							break;
+						}
+
+						strncpy(operation->path.output, optarg, sizeof(operation->path.output));
+					}
+					break;
+
+				case 'm':
+					{
+						if (operation->memoryType != BURNER_MEMORY_TYPE_NONE) {
+							ret = COMMON_ERROR_BAD_PARAMETER;
+
+							break;
+						}
+
+						if (strcasecmp("flash", optarg) == 0) {
+							operation->memoryType = BURNER_MEMORY_TYPE_FLASH;
+
+						} else if (strcasecmp("e2prom", optarg) == 0) {
+							operation->memoryType = BURNER_MEMORY_TYPE_E2PROM;
+
+						} else {
+							REPORT_ERR(("Not supported memory type '%s'! Supported are only: flash|e2prom", optarg));
+
+							ret = COMMON_ERROR_BAD_PARAMETER;
+						}
+					}
+					break;
+
+				case 'r':
+					{
+						options->session.reset = TRUE;
+					}
+					break;
+
+				case 'c':
+					{
+						options->session.commit = TRUE;
+					}
+					break;
+
+				case 1:
+					{
+						operation->parameters.erase.startPage = atoi(optarg);
+					}
+					break;
+
+				case 2:
+					{
+						operation->parameters.erase.endPage = atoi(optarg);
+					}
+					break;
+
+				case 3:
+					{
+						operation->parameters.read.offset  = atoi(optarg);
+						operation->parameters.write.offset = atoi(optarg);
+					}
+					break;
+
+				case 4:
+					{
+						operation->parameters.read.size = atoi(optarg);
+					}
+					break;
+
+				case 5:
+					{
+						if (strcasecmp("crc", optarg) == 0) {
+							options->verifyMode = BURNER_VERIFY_MODE_CRC;
+
+						} else if (strcasecmp("readback", optarg) == 0) {
+							options->verifyMode = BURNER_VERIFY_MODE_READBACK;
+
+						} else if (strcasecmp("none", optarg) == 0) {
+							options->verifyMode = BURNER_VERIFY_MODE_NONE;
+
+						} else {
+							REPORT_ERR(("Not supported verify mode '%s'! Supported are only: crc|readback|none", optarg));
+
+							ret = COMMON_ERROR_BAD_PARAMETER;
+						}
+					}
+					break;
+
+				case 6:
+					{
+						options->differential = TRUE;
+					}
+					break;
+
+				case 7:
+					{
+						options->transport          = BOOTLOADER_TRANSPORT_SIMULATOR;
+						options->transportParameter = optarg;
+					}
+					break;
+
+				case 8:
+					{
+						options->allDevices = TRUE;
+					}
+					break;
+
+				case 9:
+					{
+						unsigned int bus;
+						unsigned int address;
+
+						if (options->devicesCount == BURNER_DEVICES_MAX) {
+							REPORT_ERR(("Too many devices, up to %d are supported!", BURNER_DEVICES_MAX));
+
+							ret = COMMON_ERROR_BAD_PARAMETER;
+							break;
+						}
+
+						if (sscanf(optarg, "%u:%u", &bus, &address) != 2) {
+							REPORT_ERR(("Bad device '%s'! Expected format is <bus>:<address>", optarg));
+
+							ret = COMMON_ERROR_BAD_PARAMETER;
+							break;
+						}
+
+						snprintf(options->devices[options->devicesCount++].name, BOOTLOADER_DEVICE_ID_LENGTH_MAX, "%03u:%03u", bus, address);
+					}
+					break;
+
+				case 10:
+					{
+						options->daemonSocket = optarg;
+					}
+					break;
+
+				case 11:
+					{
+						options->clientSocket = optarg;
+					}
+					break;
+
+				case 12:
+					{
+						if (optarg == NULL) {
+							options->session.statistics = BURNER_STATISTICS_FORMAT_TEXT;
+
+						} else if (strcasecmp("json", optarg) == 0) {
+							options->session.statistics = BURNER_STATISTICS_FORMAT_JSON;
+
+						} else {
+							REPORT_ERR(("Not supported statistics format '%s'! Supported is only: json", optarg));
+
+							ret = COMMON_ERROR_BAD_PARAMETER;
+						}
+					}
+					break;
+
+				case 13:
+					{
+						operation->resume = TRUE;
+
+						if (optarg != NULL) {
+							strncpy(operation->path.journal, optarg, sizeof(operation->path.journal) - 1);
+						}
+					}
+					break;
+
+				case 14:
+					{
+						char *directory = options->session.cacheDirectory;
+
+						if (optarg != NULL) {
+							snprintf(directory, PATH_LENGTH_MAX, "%s", optarg);
+
+						} else if (getenv("XDG_CACHE_HOME") != NULL) {
+							snprintf(directory, PATH_LENGTH_MAX, "%s/jboot", getenv("XDG_CACHE_HOME"));
+
+						} else if (getenv("HOME") != NULL) {
+							snprintf(directory, PATH_LENGTH_MAX, "%s/.cache/jboot", getenv("HOME"));
+
+						} else {
+							REPORT_ERR(("Cache directory has to be given!"));
+
+							ret = COMMON_ERROR_BAD_PARAMETER;
+						}
+					}
+					break;
+
+				case 15:
+					{
+						snprintf(options->session.statisticsPath, PATH_LENGTH_MAX, "%s", optarg);
+					}
+					break;
+
+				case '?':
+					ret = COMMON_ERROR_BAD_PARAMETER;
+					break;
+
+				default:
+					break;
+			}
+
+			// Later verbs must not hide an error of previous option
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+		}
+
+		{
+			BurnerOperationDescription *first = &options->session.operations[0];
+			_U32                        i;
+
+			// Session may only commit or reset, daemon itself does not need any operation
+			if ((options->session.operationsCount == 1) && (first->type == BURNER_OPERATION_NONE) &&
+				(first->path.input[0] == '\0') && (first->path.output[0] == '\0') && (first->memoryType == BURNER_MEMORY_TYPE_NONE) &&
+				(options->session.reset || options->session.commit || (options->daemonSocket != NULL))
+			) {
+				options->session.operationsCount = 0;
+			}
+
+			for (i = 0; i < options->session.operationsCount; i++) {
+				BurnerOperationDescription *sessionOperation = &options->session.operations[i];
+
+				// Options without verb
+				if (sessionOperation->type == BURNER_OPERATION_NONE) {
+					ret = COMMON_ERROR_BAD_PARAMETER;
+				}
+
+				if ((options->allDevices || (options->devicesCount > 1)) && (sessionOperation->type == BURNER_OPERATION_READ)) {
+					REPORT_ERR(("Memory can be dumped from single device only!"));
+
+					ret = COMMON_ERROR_BAD_PARAMETER;
+				}
+
+				sessionOperation->verifyMode   = options->verifyMode;
+				sessionOperation->differential = options->differential;
+			}
+		}
+
+		if (ret != COMMON_NO_ERROR) {
+			_showUsage(argv[0]);
+
+			break;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _connect(Bootloader **bootloader, const char *deviceId, BootloaderTargetInformation *targetInformation) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	if (deviceId != NULL) {
+		REPORT(("Connecting to %s...", deviceId));
+
+	} else {
+		REPORT(("Connecting..."));
+	}
+
+	ret = bootloader_connect(bootloader, deviceId, targetInformation, BOOTLOADER_TIMEOUT);
+	if (ret != COMMON_NO_ERROR) {
+		if (deviceId != NULL) {
+			REPORT_ERR(("Unable to connect to device %s!", deviceId));
+
+		} else {
+			REPORT_ERR(("No device with active bootloader found!"));
+		}
+
+		return COMMON_ERROR_NO_DEVICE;
+	}
+
+	REPORT(("Found MCU '%s' with bootloader version: %d.%d (capabilities: %04x).",
+		targetInformation->mcu.name, targetInformation->bootloader.versionMajor, targetInformation->bootloader.versionMinor,
+		targetInformation->bootloader.capabilities
+	));
+
+	REPORT(("MCU flash size: %d (%d pages), page size: %d, e2prom size: %d",
+		targetInformation->flash.pageSize * targetInformation->flash.pagesCount, targetInformation->flash.pagesCount,
+		targetInformation->flash.pageSize, targetInformation->e2prom.size
+	));
+
+	return ret;
+}
+
+
+/*
+ * Cache belongs to the image committed to a device, not to its bus address.
+ * It is identified by MCU and used length and checksum from image header,
+ * the last application page holding it is read to flash map if needed.
+ */
+static CommonError _cachePath(Bootloader *bootloader, char *path, _U32 pathSize, BurnerSession *session, BootloaderTargetInformation *targetInformation, FlashMemory *flash) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		_U32 lastPage     = flash->blocksCount - 1;
+		_U8 *lastPageData = flash->blocks[lastPage].data;
+		_U8 *header       = lastPageData + flash->blockSize;
+
+		path[0] = '\0';
+
+		if (! flash->blocks[lastPage].read) {
+			ret = bootloader_flashPageRead(bootloader, lastPage, lastPageData, flash->blockSize, BOOTLOADER_TIMEOUT, NULL);
+			if (ret != COMMON_NO_ERROR) {
+				REPORT(("Unable to read image header, flash cache is not used."));
+
+				break;
+			}
+
+			flash->blocks[lastPage].read = TRUE;
+		}
+
+		if (header[-IMAGE_HEADER_OFFSET_MAGIC] == IMAGE_HEADER_MAGIC) {
+			snprintf(path, pathSize, "%s/%s-%02x%02x-%02x.cache", session->cacheDirectory, targetInformation->mcu.name,
+				header[-IMAGE_HEADER_OFFSET_LENGTH + 1], header[-IMAGE_HEADER_OFFSET_LENGTH], header[-IMAGE_HEADER_OFFSET_CHECKSUM]
+			);
+
+		} else {
+			snprintf(path, pathSize, "%s/%s-uncommitted.cache", session->cacheDirectory, targetInformation->mcu.name);
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+/*
+ * Fills flash map with cached pages which still match checksums reported by
+ * device, they do not have to be read back then.
+ */
+static void _cacheLoad(Bootloader *bootloader, const char *cachePath, FlashMemory *flash) {
+	_BOOL *pagesKnown = NULL;
+	_U16  *pagesCrc   = NULL;
+	_U8   *buffer     = NULL;
+
+	do {
+		_U32 pagesValid = 0;
+		_U32 i;
+
+		pagesKnown = malloc(flash->blocksCount * sizeof(*pagesKnown));
+		pagesCrc   = malloc(flash->blocksCount * sizeof(*pagesCrc));
+		buffer     = malloc(flash->blocksCount * flash->blockSize);
+		if ((pagesKnown == NULL) || (pagesCrc == NULL) || (buffer == NULL)) {
+			ERR(("_cacheLoad(): No more free memory!"));
+
+			break;
+		}
+
+		if (cache_load(cachePath, flash->blockSize, flash->blocksCount, buffer, pagesKnown) != COMMON_NO_ERROR) {
+			DBG(("_cacheLoad(): No valid cache at '%s'", cachePath));
+
+			break;
+		}
+
+		if (bootloader_flashPagesCrc(bootloader, 0, flash->blocksCount, pagesCrc, BOOTLOADER_TIMEOUT) != COMMON_NO_ERROR) {
+			REPORT(("Unable to validate flash cache, pages will be read from device."));
+
+			break;
+		}
+
+		for (i = 0; i < flash->blocksCount; i++) {
+			if (! pagesKnown[i] || flash->blocks[i].read) {
+				continue;
+			}
+
+			if (crc16_get(buffer + i * flash->blockSize, flash->blockSize, PAGE_CHECKSUM_INITIAL) != pagesCrc[i]) {
+				continue;
+			}
+
+			memcpy(flash->blocks[i].data, buffer + i * flash->blockSize, flash->blockSize);
+
+			flash->blocks[i].read = TRUE;
+
+			pagesValid++;
+		}
+
+		REPORT(("%d of %d flash pages known from cache.", pagesValid, flash->blocksCount));
+	} while (0);
+
+	if (buffer != NULL) {
+		free(buffer);
+	}
+
+	if (pagesCrc != NULL) {
+		free(pagesCrc);
+	}
+
+	if (pagesKnown != NULL) {
+		free(pagesKnown);
+	}
+}
+
+
+static void _cacheStore(const char *cachePath, FlashMemory *flash) {
+	_BOOL *pagesKnown = malloc(flash->blocksCount * sizeof(*pagesKnown));
+	_U32   i;
+
+	if (pagesKnown == NULL) {
+		return;
+	}
+
+	for (i = 0; i < flash->blocksCount; i++) {
+		pagesKnown[i] = flash->blocks[i].read;
+	}
+
+	if (cache_store(cachePath, flash->blockSize, flash->blocksCount, flash->buffer, pagesKnown) != COMMON_NO_ERROR) {
+		REPORT(("Unable to store flash cache at '%s'!", cachePath));
+	}
+
+	free(pagesKnown);
+}
+
+
+static CommonError _handleSession(Bootloader *bootloader, const char *deviceId, BootloaderTargetInformation *targetInformation, BurnerSession *session, BurnerDeviceStatistics *deviceStatistics) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		FlashMemory   flashMemory  = { 0 };
+		E2promMemory  e2promMemory = { 0 };
+		char          cachePath[PATH_LENGTH_MAX * 2] = { 0 };
+
+		do {
+			_U32 i;
+
+			deviceStatistics->valid = FALSE;
+
+			// Counters left by previous sessions are dropped, devices without them are skipped
+			if (session->statistics != BURNER_STATISTICS_FORMAT_NONE) {
+				bootloader_getDeviceStatistics(bootloader, TRUE, &deviceStatistics->counters, BOOTLOADER_TIMEOUT);
+			}
+
+			// Allocate structure for flash memory blocks, kept for all operations of the session
+			{
+				flashMemory.blockSize   = targetInformation->flash.pageSize;
+				flashMemory.blocksCount = targetInformation->flash.pagesCount;
+
+				flashMemory.blocks = malloc(flashMemory.blocksCount * sizeof(FlashMemoryBlock));
+				if (flashMemory.blocks == NULL) {
+					ERR(("_handleSession(): Unable to allocate memory!"));
+
+					ret = COMMON_ERROR_NO_FREE_RESOURCES;
+					break;
+				}
+
+				flashMemory.buffer = malloc(flashMemory.blockSize * flashMemory.blocksCount);
+				if (flashMemory.buffer == NULL) {
+					ERR(("_handleSession(): Unable to allocate memory!"));
+
+					ret = COMMON_ERROR_NO_FREE_RESOURCES;
+					break;
+				}
+
+				memset(flashMemory.buffer, 0, flashMemory.blockSize * flashMemory.blocksCount);
+
+				for (i = 0; i < flashMemory.blocksCount; i++) {
+					flashMemory.blocks[i].read = FALSE;
+					flashMemory.blocks[i].data = flashMemory.buffer + i * flashMemory.blockSize;
+				}
+			}
+
+			// Allocate memory for e2prom map
+			{
+				e2promMemory.size = targetInformation->e2prom.size;
+
+				e2promMemory.buffer = malloc(e2promMemory.size);
+				if (e2promMemory.buffer == NULL) {
+					ERR(("_handleSession(): Unable to allocate memory!"));
+
+					ret = COMMON_ERROR_NO_FREE_RESOURCES;
+					break;
+				}
+			}
+
+			if (session->cacheDirectory[0] != '\0') {
+				if (_cachePath(bootloader, cachePath, sizeof(cachePath), session, targetInformation, &flashMemory) == COMMON_NO_ERROR) {
+					_cacheLoad(bootloader, cachePath, &flashMemory);
+				}
+			}
+
+			// Perform operations
+			for (i = 0; i < session->operationsCount; i++) {
+				if (session->operationsCount > 1) {
+					REPORT(("Operation %d of %d.", i + 1, session->operationsCount));
+				}
+
+				ret = _handleOperation(bootloader, deviceId, targetInformation, &session->operations[i], &flashMemory, &e2promMemory);
+				if (ret != COMMON_NO_ERROR) {
+					REPORT_ERR(("Operation failed!"));
+
+					break;
+				}
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if (session->commit) {
+				ret = _handleCommit(bootloader, &flashMemory);
+				if (ret != COMMON_NO_ERROR) {
+					REPORT_ERR(("Unable to write flash checksum!"));
+
+					break;
+				}
+			}
+
+			// Session may have changed image header, it is taken before reset disconnects device
+			if (cachePath[0] != '\0') {
+				_cachePath(bootloader, cachePath, sizeof(cachePath), session, targetInformation, &flashMemory);
+			}
+
+			if (session->statistics != BURNER_STATISTICS_FORMAT_NONE) {
+				deviceStatistics->valid = (bootloader_getDeviceStatistics(bootloader, FALSE, &deviceStatistics->counters, BOOTLOADER_TIMEOUT) == COMMON_NO_ERROR);
+			}
+
+			if (session->reset) {
+				REPORT(("Resetting MCU..."));
+
+				ret = bootloader_reset(bootloader, BOOTLOADER_TIMEOUT);
+				if (ret != COMMON_NO_ERROR) {
+					REPORT_ERR(("Unable to reset MCU!"));
+
+					break;
+				}
+			}
+		} while (0);
+
+		// Stored also after failure, pages are validated by checksum when loaded
+		if (cachePath[0] != '\0') {
+			_cacheStore(cachePath, &flashMemory);
+		}
+
+		if (e2promMemory.buffer != NULL) {
+			free(e2promMemory.buffer);
+		}
+
+		if (flashMemory.buffer != NULL) {
+			free(flashMemory.buffer);
+		}
+
+		if (flashMemory.blocks != NULL) {
+			free(flashMemory.blocks);
+		}
+	}
+
+	return ret;
+}
+
+
+/*
+ * Returns statistics of the session formatted to allocated string, NULL on
+ * error. JSON one is a single object, main joins objects of all devices.
+ */
+static char *_reportStatistics(Bootloader *bootloader, const char *deviceId, BurnerStatisticsFormat format, BurnerDeviceStatistics *deviceStatistics) {
+	BootloaderStatistics statistics;
+	_U64                 bytes = 0;
+	_U64                 throughput;
+	_U32                 i;
+	FILE                *stream;
+	char                *ret = NULL;
+	size_t               retSize;
+
+	if (format == BURNER_STATISTICS_FORMAT_NONE) {
+		return NULL;
+	}
+
+	if (bootloader_getStatistics(bootloader, &statistics) != COMMON_NO_ERROR) {
+		REPORT_ERR(("Unable to get statistics!"));
+
+		return NULL;
+	}
+
+	stream = open_memstream(&ret, &retSize);
+	if (stream == NULL) {
+		ERR(("_reportStatistics(): No more free memory!"));
+
+		return NULL;
+	}
+
+	for (i = 0; i < BOOTLOADER_COMMAND_TYPES_COUNT; i++) {
+		bytes += statistics.commands[i].bytes;
+	}
+
+	throughput = (statistics.time > 0) ? bytes * 1000000 / statistics.time : 0;
+
+	if (format == BURNER_STATISTICS_FORMAT_JSON) {
+		fprintf(stream, "{\"device\":");
+		if (deviceId != NULL) {
+			fprintf(stream, "\"%s\"", deviceId);
+
+		} else {
+			fprintf(stream, "null");
+		}
+
+		fprintf(stream, ",\"time_us\":%llu,\"bytes\":%llu,\"throughput\":%llu,\"commands\":{",
+			(unsigned long long) statistics.time, (unsigned long long) bytes, (unsigned long long) throughput
+		);
+
+		for (i = 0; i < BOOTLOADER_COMMAND_TYPES_COUNT; i++) {
+			BootloaderCommandStatistics *command = &statistics.commands[i];
+
+			fprintf(stream, "%s\"%s\":{\"count\":%u,\"errors\":%u,\"bytes\":%llu,\"min_us\":%u,\"avg_us\":%u,\"p99_us\":%u,\"max_us\":%u}",
+				(i > 0) ? "," : "", bootloader_commandTypeName(i), command->count, command->errors, (unsigned long long) command->bytes,
+				command->timeMin, command->timeAverage, command->timeP99, command->timeMax
+			);
+		}
+
+		fprintf(stream, "},\"target\":");
+		if (deviceStatistics->valid) {
+			BootloaderDeviceStatistics *counters = &deviceStatistics->counters;
+
+			fprintf(stream, "{\"setup_requests\":%u,\"bytes_in\":%u,\"bytes_out\":%u,\"pages_erased\":%u,\"pages_written\":%u,\"spm_busy_us\":%llu,\"watchdog_resets\":%u,\"boot_check_us\":%u}",
+				counters->setupRequests, counters->bytesIn, counters->bytesOut, counters->pagesErased, counters->pagesWritten,
+				(unsigned long long) counters->spmBusyTime, counters->watchdogResets, counters->bootCheckTime
+			);
+
+		} else {
+			fprintf(stream, "null");
+		}
+
+		fprintf(stream, "}");
+
+	} else {
+		fprintf(stream, " \n");
+
+		if (deviceId != NULL) {
+			fprintf(stream, "Statistics of %s:\n", deviceId);
+
+		} else {
+			fprintf(stream, "Statistics:\n");
+		}
+
+		fprintf(stream, "  %-12s %6s %6s %10s %10s %10s %10s %10s\n", "command", "count", "errors", "bytes", "min [us]", "avg [us]", "p99 [us]", "max [us]");
+
+		for (i = 0; i < BOOTLOADER_COMMAND_TYPES_COUNT; i++) {
+			BootloaderCommandStatistics *command = &statistics.commands[i];
+
+			if (command->count == 0) {
+				continue;
+			}
+
+			fprintf(stream, "  %-12s %6u %6u %10llu %10u %10u %10u %10u\n",
+				bootloader_commandTypeName(i), command->count, command->errors, (unsigned long long) command->bytes,
+				command->timeMin, command->timeAverage, command->timeP99, command->timeMax
+			);
+		}
+
+		fprintf(stream, "  %llu bytes in %llu.%03llu s, %llu bytes/s.\n",
+			(unsigned long long) bytes, (unsigned long long) (statistics.time / 1000000), (unsigned long long) (statistics.time / 1000 % 1000),
+			(unsigned long long) throughput
+		);
+
+		if (deviceStatistics->valid) {
+			BootloaderDeviceStatistics *counters = &deviceStatistics->counters;
+
+			fprintf(stream, "  Device: %u SETUP requests, %u bytes received, %u bytes sent, %u pages erased, %u pages written.\n",
+				counters->setupRequests, counters->bytesIn, counters->bytesOut, counters->pagesErased, counters->pagesWritten
+			);
+
+			// Rest of session time is spent by host and USB transfers
+			fprintf(stream, "  Device: flash busy %llu.%03llu s, watchdog resets: %u, image check at boot %u.%03u ms.\n",
+				(unsigned long long) (counters->spmBusyTime / 1000000), (unsigned long long) (counters->spmBusyTime / 1000 % 1000),
+				counters->watchdogResets, counters->bootCheckTime / 1000, counters->bootCheckTime % 1000
+			);
+		}
+	}
+
+	fclose(stream);
+
+	return ret;
+}
+
+
+// Statistics are written at once, so they are not interleaved with progress of other devices
+static void _writeStatistics(BurnerSession *session, char **reports, _U32 reportsCount) {
+	FILE *stream = stdout;
+	_U32  written = 0;
+	_U32  i;
+
+	if (session->statistics == BURNER_STATISTICS_FORMAT_NONE) {
+		return;
+	}
+
+	if (session->statisticsPath[0] != '\0') {
+		stream = fopen(session->statisticsPath, "w");
+		if (stream == NULL) {
+			REPORT_ERR(("Unable to open statistics file '%s'! (%m)", session->statisticsPath));
+
+			return;
+		}
+	}
+
+	flockfile(stdout);
+
+	if (session->statistics == BURNER_STATISTICS_FORMAT_JSON) {
+		fprintf(stream, "[");
+	}
+
+	for (i = 0; i < reportsCount; i++) {
+		if (reports[i] == NULL) {
+			continue;
+		}
+
+		if ((session->statistics == BURNER_STATISTICS_FORMAT_JSON) && (written > 0)) {
+			fprintf(stream, ",");
+		}
+
+		fputs(reports[i], stream);
+
+		written++;
+	}
+
+	if (session->statistics == BURNER_STATISTICS_FORMAT_JSON) {
+		fprintf(stream, "]\n");
+	}
+
+	funlockfile(stdout);
+
+	if (stream != stdout) {
+		fclose(stream);
+	}
+}
+
+
+static CommonError _handleDevice(BurnerSession *session, const char *deviceId, char **statistics) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		Bootloader                  *bootloader        = NULL;
+		BootloaderTargetInformation  targetInformation = { 0 };
+		BurnerDeviceStatistics       deviceStatistics  = { 0 };
+
+		do {
+			ret = _connect(&bootloader, deviceId, &targetInformation);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			ret = _handleSession(bootloader, deviceId, &targetInformation, session, &deviceStatistics);
+
+			*statistics = _reportStatistics(bootloader, deviceId, session->statistics, &deviceStatistics);
+		} while (0);
+
+		bootloader_disconnect(bootloader);
+	}
+
+	return ret;
+}
+
+
+static void *_deviceThread(void *arg) {
+	BurnerDevice *device = arg;
+
+	{
+		_U32 startTime = _getTime();
+
+		device->result = _handleDevice(device->session, device->id.name, &device->statistics);
+		device->time   = _getTime() - startTime;
+	}
+
+	return NULL;
+}
+
+
+static CommonError _handleRequest(int argc, char *argv[], void *context) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		BurnerDaemon           *daemon           = context;
+		BurnerOptions           options;
+		BurnerDeviceStatistics  deviceStatistics = { 0 };
+
+		do {
+			ret = _parseOptions(argc, argv, &options);
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			if ((options.daemonSocket != NULL) || options.allDevices || (options.devicesCount > 0) || (options.transport != BOOTLOADER_TRANSPORT_LIBUSB)) {
+				REPORT_ERR(("Device and transport are selected when daemon is started!"));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			// Connection is lost after reset or error, restored transparently by next request
+			if (daemon->bootloader == NULL) {
+				ret = _connect(&daemon->bootloader, daemon->deviceId, &daemon->targetInformation);
+				if (ret != COMMON_NO_ERROR) {
+					break;
+				}
+			}
+
+			ret = _handleSession(daemon->bootloader, daemon->deviceId, &daemon->targetInformation, &options.session, &deviceStatistics);
+
+			// Every request gets statistics of its own commands
+			{
+				char *statistics = _reportStatistics(daemon->bootloader, daemon->deviceId, options.session.statistics, &deviceStatistics);
+
+				_writeStatistics(&options.session, &statistics, 1);
+
+				free(statistics);
+			}
+
+			bootloader_clearStatistics(daemon->bootloader);
+			if ((ret != COMMON_NO_ERROR) || options.session.reset) {
+				bootloader_disconnect(daemon->bootloader);
+
+				daemon->bootloader = NULL;
+			}
+		} while (0);
+	}
+
+	return ret;
+}
+
+
+int main(int argc, char *argv[]) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		BurnerOptions options;
+		BurnerDevice  devices[BURNER_DEVICES_MAX];
+		_U32          devicesCount = 0;
+
+		DBG(("START"));
+
+		ret = _loadScripts(&argc, &argv);
+		if (ret != COMMON_NO_ERROR) {
+			break;
+		}
+
+		ret = _parseOptions(argc, argv, &options);
+		if (ret != COMMON_NO_ERROR) {
+			break;
+		}
+
+		// Request is executed by daemon which already holds the device
+		if (options.clientSocket != NULL) {
+			CommonError result = COMMON_ERROR;
+
+			ret = daemon_request(options.clientSocket, argc - 1, argv + 1, &result);
+			if (ret == COMMON_NO_ERROR) {
+				ret = result;
+			}
+
+			return ret;
+		}
+
+		ret = bootloader_initialize(options.transport, options.transportParameter);
+		if (ret != COMMON_NO_ERROR) {
+			REPORT_ERR(("Unable to initialize device transport!"));
+
+			break;
+		}
+
+		if (options.daemonSocket != NULL) {
+			BurnerDaemon daemon = { 0 };
+
+			if (options.allDevices || (options.devicesCount > 1)) {
+				REPORT_ERR(("Daemon serves single device only!"));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+
+				bootloader_terminate();
+				break;
+			}
+
+			if (options.devicesCount == 1) {
+				daemon.deviceId = options.devices[0].name;
+			}
+
+			// Device absent at startup is looked for again by the first request
+			if (_connect(&daemon.bootloader, daemon.deviceId, &daemon.targetInformation) != COMMON_NO_ERROR) {
+				daemon.bootloader = NULL;
+			}
+
+			ret = daemon_run(options.daemonSocket, _handleRequest, &daemon);
+
+			bootloader_disconnect(daemon.bootloader);
+
+			bootloader_terminate();
+			break;
+		}
+
+		// Single device mode, the first found device is used
+		if (! options.allDevices && (options.devicesCount == 0)) {
+			char *statistics = NULL;
+
+			ret = _handleDevice(&options.session, NULL, &statistics);
+
+			_writeStatistics(&options.session, &statistics, 1);
+
+			free(statistics);
+
+			bootloader_terminate();
+			break;
+		}
+
+		if (options.allDevices) {
+			BootloaderDeviceId ids[BURNER_DEVICES_MAX];
+			_U32               i;
+
+			ret = bootloader_enumerate(ids, BURNER_DEVICES_MAX, &devicesCount);
+			if (ret != COMMON_NO_ERROR) {
+				REPORT_ERR(("Unable to list attached devices!"));
+
+				bootloader_terminate();
+				break;
+			}
+
+			if (devicesCount == 0) {
+				REPORT_ERR(("No device with active bootloader found!"));
+
+				ret = COMMON_ERROR_NO_DEVICE;
+
+				bootloader_terminate();
+				break;
+			}
+
+			for (i = 0; i < devicesCount; i++) {
+				devices[i].id = ids[i];
+			}
+
+		} else {
+			_U32 i;
+
+			devicesCount = options.devicesCount;
+
+			for (i = 0; i < devicesCount; i++) {
+				devices[i].id = options.devices[i];
+			}
+		}
+
+		// One worker per device, devices are flashed concurrently
+		{
+			_U32 failedCount = 0;
+			_U32 i;
+
+			REPORT(("Processing %d devices...", devicesCount));
+
+			for (i = 0; i < devicesCount; i++) {
+				devices[i].session    = &options.session;
+				devices[i].result     = COMMON_ERROR;
+				devices[i].time       = 0;
+				devices[i].started    = FALSE;
+				devices[i].statistics = NULL;
+
+				if (pthread_create(&devices[i].thread, NULL, _deviceThread, &devices[i]) != 0) {
+					REPORT_ERR(("Unable to start worker for device %s!", devices[i].id.name));
+
+					continue;
+				}
+
+				devices[i].started = TRUE;
+			}
+
+			for (i = 0; i < devicesCount; i++) {
+				if (devices[i].started) {
+					pthread_join(devices[i].thread, NULL);
+				}
+			}
+
+			{
+				char *statistics[BURNER_DEVICES_MAX];
+
+				for (i = 0; i < devicesCount; i++) {
+					statistics[i] = devices[i].statistics;
+				}
+
+				_writeStatistics(&options.session, statistics, devicesCount);
+
+				for (i = 0; i < devicesCount; i++) {
+					free(statistics[i]);
+				}
+			}
+
+			REPORT((" "));
+			REPORT(("Summary:"));
+
+			for (i = 0; i < devicesCount; i++) {
+				if (devices[i].result == COMMON_NO_ERROR) {
+					REPORT(("  %s: OK (%d.%03d s)", devices[i].id.name, devices[i].time / 1000, devices[i].time % 1000));
+
+				} else {
+					REPORT(("  %s: FAILED (%d)", devices[i].id.name, devices[i].result));
+
+					failedCount++;
+				}
+			}
+
+			REPORT(("%d of %d devices succeeded.", devicesCount - failedCount, devicesCount));
+
+			if (failedCount > 0) {
+				ret = COMMON_ERROR;
+			}
+		}
+
+		bootloader_terminate();
+	} while (0);
+
 	REPORT(("Exiting..."));
 
 	return ret;
@@ -0,0 +1,702 @@
+#include <libusb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "burner/transport.h"
+
+#define DEBUG_LEVEL 4
+#include "burner/common/debug.h"
+
+
+// Bus polling interval, used only when hotplug events are not available
+#define LIBUSB_CHECK_DEVICES_INTERVAL 200
+
+// After device is added its node may not be accessible yet (udev rules),
+// opening is retried in short intervals for a while.
+#define LIBUSB_SETTLE_INTERVAL 5
+#define LIBUSB_SETTLE_TIME     1000
+
+#define LIBUSB_REJECTED_CACHE_SIZE 64
+
+// Event loop wakes up periodically to check whether it should stop
+#define LIBUSB_EVENTS_TIMEOUT 100
+
+
+struct _TransportDevice {
+	libusb_device_handle *handle;
+};
+
+
+// Device which was found not to be a jboot bootloader
+typedef struct _LibusbRejectedDevice {
+	TransportDeviceId id;
+	_U16              idVendor;
+	_U16              idProduct;
+	_U16              bcdDevice;
+} LibusbRejectedDevice;
+
+
+// Control transfer in flight
+typedef struct _LibusbRequest {
+	TransportCompletion  completion;
+	void                *context;
+	_U8                 *buffer;
+} LibusbRequest;
+
+
+// Completion of transfer waited for by synchronous call
+typedef struct _LibusbSyncRequest {
+	_BOOL done;
+	_S32  result;
+} LibusbSyncRequest;
+
+
+static const _U16 idVendor  = 0x16c0;
+static const _U16 idProduct = 0x05dc;
+
+static const char *deviceName = "USB jboot";
+static const char *vendorName = "obdev.at";
+
+
+static libusb_context *context = NULL;
+
+// Handles transfers completion and hotplug events of all devices
+static pthread_t eventThread;
+
+static volatile _BOOL eventThreadRunning = FALSE;
+
+static _BOOL hotplugAvailable = FALSE;
+
+static libusb_hotplug_callback_handle hotplugHandle;
+
+// Protects hotplug counter and completion of synchronous requests
+static pthread_mutex_t eventMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  eventCond  = PTHREAD_COND_INITIALIZER;
+
+// Incremented on every bootloader device arrival
+static _U32 hotplugEvents = 0;
+
+// Devices may be looked for by concurrent workers
+static pthread_mutex_t scanMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static LibusbRejectedDevice rejectedDevices[LIBUSB_REJECTED_CACHE_SIZE];
+
+static _U32 rejectedDevicesCount = 0;
+
+static _U32 rejectedDevicesNext = 0;
+
+static __thread int lastError = LIBUSB_SUCCESS;
+
+
+static _U32 _getTime(void) {
+	_U32 ret = 0;
+
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+
+		ret = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+
+	return ret;
+}
+
+
+static void *_eventThread(void *arg) {
+	while (eventThreadRunning) {
+		struct timeval tv = { 0, LIBUSB_EVENTS_TIMEOUT * 1000 };
+
+		libusb_handle_events_timeout_completed(context, &tv, NULL);
+	}
+
+	return NULL;
+}
+
+
+static int LIBUSB_CALL _hotplugCallback(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *userData) {
+	DBG(("_hotplugCallback(): Device added."));
+
+	// Device is opened by waiting thread, callback must not block event loop
+	pthread_mutex_lock(&eventMutex);
+	hotplugEvents++;
+	pthread_cond_broadcast(&eventCond);
+	pthread_mutex_unlock(&eventMutex);
+
+	return 0;
+}
+
+
+/*
+ * Waits up to timeout (negative means forever) for a device with bootloader
+ * VID/PID being added. Returns TRUE if such event was received.
+ */
+static _BOOL _hotplugWait(_U32 *eventsSeen, _S32 timeout) {
+	_BOOL ret = FALSE;
+
+	pthread_mutex_lock(&eventMutex);
+
+	if (hotplugEvents == *eventsSeen) {
+		if (timeout < 0) {
+			pthread_cond_wait(&eventCond, &eventMutex);
+
+		} else {
+			struct timeval  now;
+			struct timespec deadline;
+
+			gettimeofday(&now, NULL);
+
+			deadline.tv_sec  = now.tv_sec + timeout / 1000;
+			deadline.tv_nsec = now.tv_usec * 1000 + (timeout % 1000) * 1000000;
+
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+
+			pthread_cond_timedwait(&eventCond, &eventMutex, &deadline);
+		}
+	}
+
+	if (hotplugEvents != *eventsSeen) {
+		*eventsSeen = hotplugEvents;
+
+		ret = TRUE;
+	}
+
+	pthread_mutex_unlock(&eventMutex);
+
+	return ret;
+}
+
+
+static _BOOL _libusbIsRejected(struct libusb_device_descriptor *descriptor, const TransportDeviceId *id) {
+	_U32 i;
+
+	for (i = 0; i < rejectedDevicesCount; i++) {
+		LibusbRejectedDevice *rejected = &rejectedDevices[i];
+
+		if (
+			(strcmp(rejected->id.name, id->name) == 0) &&
+			(rejected->idVendor  == descriptor->idVendor) &&
+			(rejected->idProduct == descriptor->idProduct) &&
+			(rejected->bcdDevice == descriptor->bcdDevice)
+		) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+
+static void _libusbReject(struct libusb_device_descriptor *descriptor, const TransportDeviceId *id) {
+	// Oldest entries are overwritten when cache is full
+	LibusbRejectedDevice *rejected = &rejectedDevices[rejectedDevicesNext];
+
+	rejectedDevicesNext = (rejectedDevicesNext + 1) % LIBUSB_REJECTED_CACHE_SIZE;
+
+	DBG(("_libusbReject(): Device %s is not a bootloader.", id->name));
+
+	rejected->id        = *id;
+	rejected->idVendor  = descriptor->idVendor;
+	rejected->idProduct = descriptor->idProduct;
+	rejected->bcdDevice = descriptor->bcdDevice;
+
+	if (rejectedDevicesCount < LIBUSB_REJECTED_CACHE_SIZE) {
+		rejectedDevicesCount++;
+	}
+}
+
+
+static CommonError _libusbInitialize(const char *parameter) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		int libUsbRet;
+
+		rejectedDevicesCount = 0;
+		rejectedDevicesNext  = 0;
+		hotplugEvents        = 0;
+
+		libUsbRet = libusb_init(&context);
+		if (libUsbRet != LIBUSB_SUCCESS) {
+			ERR(("_libusbInitialize(): libusb_init() failed! (%s)", libusb_error_name(libUsbRet)));
+
+			ret = COMMON_ERROR;
+			break;
+		}
+
+		hotplugAvailable = FALSE;
+
+		if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+			libUsbRet = libusb_hotplug_register_callback(
+				context, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, 0, idVendor, idProduct, LIBUSB_HOTPLUG_MATCH_ANY,
+				_hotplugCallback, NULL, &hotplugHandle
+			);
+
+			hotplugAvailable = (libUsbRet == LIBUSB_SUCCESS);
+		}
+
+		if (! hotplugAvailable) {
+			DBG(("_libusbInitialize(): Hotplug events not available, falling back to bus polling."));
+		}
+
+		eventThreadRunning = TRUE;
+
+		if (pthread_create(&eventThread, NULL, _eventThread, NULL) != 0) {
+			ERR(("_libusbInitialize(): Unable to start event thread!"));
+
+			eventThreadRunning = FALSE;
+
+			if (hotplugAvailable) {
+				libusb_hotplug_deregister_callback(context, hotplugHandle);
+			}
+
+			libusb_exit(context);
+
+			context = NULL;
+			ret     = COMMON_ERROR_NO_FREE_RESOURCES;
+			break;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _libusbTerminate(void) {
+	if (context != NULL) {
+		eventThreadRunning = FALSE;
+
+		if (hotplugAvailable) {
+			libusb_hotplug_deregister_callback(context, hotplugHandle);
+		}
+
+		pthread_join(eventThread, NULL);
+
+		libusb_exit(context);
+
+		context = NULL;
+	}
+
+	return COMMON_NO_ERROR;
+}
+
+
+// Returns opened device handle if device is a jboot bootloader, NULL otherwise
+static libusb_device_handle *_libusbOpenBootloader(libusb_device *dev, const TransportDeviceId *id) {
+	libusb_device_handle *ret = NULL;
+
+	{
+		libusb_device_handle            *tmpHandle = NULL;
+		struct libusb_device_descriptor  descriptor;
+		int                              libUsbRet;
+
+		do {
+			if (libusb_get_device_descriptor(dev, &descriptor) != LIBUSB_SUCCESS) {
+				break;
+			}
+
+			DBG(("_libusbOpenBootloader(): Found device with PID: %04x VID: %04x", descriptor.idProduct, descriptor.idVendor));
+
+			if (
+				(descriptor.idVendor  != idVendor) ||
+				(descriptor.idProduct != idProduct)
+			) {
+				break;
+			}
+
+			// Skip reading string descriptors of devices known to be other V-USB ones
+			if (_libusbIsRejected(&descriptor, id)) {
+				break;
+			}
+
+			DBG(("_libusbOpenBootloader(): Got device with proper PID: %04x, VID: %04x!", descriptor.idProduct, descriptor.idVendor));
+
+			// Node may be still being set up by udev, opening is retried by caller
+			if (libusb_open(dev, &tmpHandle) != LIBUSB_SUCCESS) {
+				DBG(("_libusbOpenBootloader(): Unable to open device with PID: %04x VID: %04x", idProduct, idVendor));
+
+				tmpHandle = NULL;
+				break;
+			}
+
+			if (descriptor.iManufacturer > 0) {
+				char vendor[256] = { 0 };
+
+				libUsbRet = libusb_get_string_descriptor_ascii(tmpHandle, descriptor.iManufacturer, (unsigned char *) vendor, sizeof(vendor));
+				if (libUsbRet >= 0) {
+					DBG(("_libusbOpenBootloader(): vendor: '%s'", vendor));
+
+					if (strcmp(vendor, vendorName) == 0) {
+						DBG(("_libusbOpenBootloader(): Found device with proper vendor!"));
+
+					} else {
+						_libusbReject(&descriptor, id);
+						break;
+					}
+
+				} else {
+					DBG(("_libusbOpenBootloader(): Error reading vendor!"));
+				}
+			}
+
+			if (descriptor.iProduct > 0) {
+				char product[256] = { 0 };
+
+				libUsbRet = libusb_get_string_descriptor_ascii(tmpHandle, descriptor.iProduct, (unsigned char *) product, sizeof(product));
+				if (libUsbRet >= 0) {
+					DBG(("_libusbOpenBootloader(): product: '%s'", product));
+
+					if (strcmp(product, deviceName) == 0) {
+						DBG(("_libusbOpenBootloader(): Found device with proper product name!"));
+
+						ret = tmpHandle;
+
+					} else {
+						_libusbReject(&descriptor, id);
+					}
+
+				} else {
+					DBG(("_libusbOpenBootloader(): Error reading product!"));
+				}
+			}
+		} while (0);
+
+		if ((ret == NULL) && (tmpHandle != NULL)) {
+			DBG(("_libusbOpenBootloader(): Closing device!"));
+
+			libusb_close(tmpHandle);
+		}
+	}
+
+	return ret;
+}
+
+
+static void _libusbGetDeviceId(libusb_device *dev, TransportDeviceId *id) {
+	snprintf(id->name, sizeof(id->name), "%03d:%03d", libusb_get_bus_number(dev), libusb_get_device_address(dev));
+}
+
+
+/*
+ * Walks all devices once. Every found bootloader is added to ids list (if
+ * given). When handle is given, the first bootloader matching id (or any if
+ * id is NULL) is left opened and walk stops.
+ */
+static void _libusbScan(const char *id, TransportDeviceId *ids, _U32 idsMax, _U32 *idsCount, libusb_device_handle **handle) {
+	libusb_device **list = NULL;
+	ssize_t         listSize;
+	ssize_t         i;
+
+	pthread_mutex_lock(&scanMutex);
+
+	listSize = libusb_get_device_list(context, &list);
+
+	DBG(("_libusbScan(): devices: %d", (int) listSize));
+
+	for (i = 0; i < listSize; i++) {
+		TransportDeviceId devId;
+
+		_libusbGetDeviceId(list[i], &devId);
+
+		if ((id == NULL) || (strcmp(id, devId.name) == 0)) {
+			libusb_device_handle *tmpHandle = _libusbOpenBootloader(list[i], &devId);
+
+			if (tmpHandle != NULL) {
+				if ((ids != NULL) && (*idsCount < idsMax)) {
+					ids[(*idsCount)++] = devId;
+				}
+
+				if (handle != NULL) {
+					*handle = tmpHandle;
+
+					break;
+				}
+
+				libusb_close(tmpHandle);
+			}
+		}
+	}
+
+	if (list != NULL) {
+		libusb_free_device_list(list, 1);
+	}
+
+	pthread_mutex_unlock(&scanMutex);
+}
+
+
+static CommonError _libusbEnumerate(TransportDeviceId *ids, _U32 idsMax, _U32 *idsCount) {
+	*idsCount = 0;
+
+	_libusbScan(NULL, ids, idsMax, idsCount, NULL);
+
+	return COMMON_NO_ERROR;
+}
+
+
+static CommonError _libusbOpen(TransportDevice **device, const char *id, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		libusb_device_handle *deviceHandle = NULL;
+
+		do {
+			_U32  startTime     = _getTime();
+			_U32  lastEventTime = 0;
+			_U32  eventsSeen;
+			_BOOL settling      = FALSE;
+			_BOOL scan          = TRUE;
+
+			pthread_mutex_lock(&eventMutex);
+			eventsSeen = hotplugEvents;
+			pthread_mutex_unlock(&eventMutex);
+
+			while (1) {
+				_S32 waitTime = -1;
+
+				if (scan || settling) {
+					_libusbScan(id, NULL, 0, NULL, &deviceHandle);
+					if (deviceHandle != NULL) {
+						break;
+					}
+				}
+
+				scan = FALSE;
+
+				if (timeout != TRANSPORT_TIMEOUT_INFINITY) {
+					_U32 elapsed = _getTime() - startTime;
+
+					if (elapsed >= timeout) {
+						ret = COMMON_ERROR_TIMEOUT;
+
+						break;
+					}
+
+					waitTime = timeout - elapsed;
+				}
+
+				if (! hotplugAvailable) {
+					if ((waitTime < 0) || (waitTime > LIBUSB_CHECK_DEVICES_INTERVAL)) {
+						waitTime = LIBUSB_CHECK_DEVICES_INTERVAL;
+					}
+
+					usleep(waitTime * 1000);
+
+					// Rejected devices are cached, so full rescan is cheap
+					scan = TRUE;
+					continue;
+				}
+
+				settling = (lastEventTime != 0) && (_getTime() - lastEventTime < LIBUSB_SETTLE_TIME);
+				if (settling) {
+					if ((waitTime < 0) || (waitTime > LIBUSB_SETTLE_INTERVAL)) {
+						waitTime = LIBUSB_SETTLE_INTERVAL;
+					}
+				}
+
+				if (_hotplugWait(&eventsSeen, waitTime)) {
+					lastEventTime = _getTime();
+
+					scan     = TRUE;
+					settling = TRUE;
+				}
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				break;
+			}
+
+			*device = malloc(sizeof(TransportDevice));
+			if (*device == NULL) {
+				ERR(("_libusbOpen(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			(*device)->handle = deviceHandle;
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (deviceHandle != NULL) {
+				libusb_close(deviceHandle);
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+static void _libusbClose(TransportDevice *device) {
+	libusb_close(device->handle);
+
+	free(device);
+}
+
+
+static void LIBUSB_CALL _libusbTransferCallback(struct libusb_transfer *transfer) {
+	LibusbRequest *request = transfer->user_data;
+	_S32           result;
+
+	switch (transfer->status) {
+		case LIBUSB_TRANSFER_COMPLETED:
+			result = transfer->actual_length;
+
+			if ((transfer->buffer[0] & LIBUSB_ENDPOINT_IN) && (result > 0)) {
+				memcpy(request->buffer, libusb_control_transfer_get_data(transfer), result);
+			}
+			break;
+
+		case LIBUSB_TRANSFER_TIMED_OUT:
+			result = LIBUSB_ERROR_TIMEOUT;
+			break;
+
+		case LIBUSB_TRANSFER_STALL:
+			result = LIBUSB_ERROR_PIPE;
+			break;
+
+		case LIBUSB_TRANSFER_NO_DEVICE:
+			result = LIBUSB_ERROR_NO_DEVICE;
+			break;
+
+		case LIBUSB_TRANSFER_CANCELLED:
+			result = LIBUSB_ERROR_INTERRUPTED;
+			break;
+
+		default:
+			result = LIBUSB_ERROR_IO;
+			break;
+	}
+
+	request->completion(result, request->context);
+
+	free(request);
+}
+
+
+static CommonError _libusbControlMsgSubmit(TransportDevice *device, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout, TransportCompletion completion, void *completionContext) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		struct libusb_transfer *transfer       = NULL;
+		LibusbRequest          *libusbRequest  = NULL;
+		_U8                    *transferBuffer = NULL;
+
+		do {
+			_U8 requestType = LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | (direction == TRANSPORT_DIRECTION_IN ? LIBUSB_ENDPOINT_IN : LIBUSB_ENDPOINT_OUT);
+			int libUsbRet;
+
+			transfer       = libusb_alloc_transfer(0);
+			libusbRequest  = malloc(sizeof(*libusbRequest));
+			transferBuffer = malloc(LIBUSB_CONTROL_SETUP_SIZE + bufferSize);
+			if ((transfer == NULL) || (libusbRequest == NULL) || (transferBuffer == NULL)) {
+				lastError = LIBUSB_ERROR_NO_MEM;
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			libusbRequest->completion = completion;
+			libusbRequest->context    = completionContext;
+			libusbRequest->buffer     = buffer;
+
+			libusb_fill_control_setup(transferBuffer, requestType, request, value, index, bufferSize);
+
+			if ((direction == TRANSPORT_DIRECTION_OUT) && (bufferSize > 0)) {
+				memcpy(transferBuffer + LIBUSB_CONTROL_SETUP_SIZE, buffer, bufferSize);
+			}
+
+			libusb_fill_control_transfer(transfer, device->handle, transferBuffer, _libusbTransferCallback, libusbRequest, timeout);
+
+			// Both are released by libusb once callback returns
+			transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+			libUsbRet = libusb_submit_transfer(transfer);
+			if (libUsbRet != LIBUSB_SUCCESS) {
+				lastError = libUsbRet;
+
+				// Not submitted, everything is released below
+				transfer->flags = 0;
+
+				ret = (libUsbRet == LIBUSB_ERROR_NO_DEVICE) ? COMMON_ERROR_NO_DEVICE : COMMON_ERROR;
+				break;
+			}
+		} while (0);
+
+		if (ret != COMMON_NO_ERROR) {
+			if (transfer != NULL) {
+				libusb_free_transfer(transfer);
+			}
+
+			if (libusbRequest != NULL) {
+				free(libusbRequest);
+			}
+
+			if (transferBuffer != NULL) {
+				free(transferBuffer);
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+static void _libusbSyncCompletion(_S32 result, void *context) {
+	LibusbSyncRequest *request = context;
+
+	pthread_mutex_lock(&eventMutex);
+	request->result = result;
+	request->done   = TRUE;
+	pthread_cond_broadcast(&eventCond);
+	pthread_mutex_unlock(&eventMutex);
+}
+
+
+// Synchronous transfer is the asynchronous one completed by event thread
+static _S32 _libusbControlMsg(TransportDevice *device, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout) {
+	LibusbSyncRequest syncRequest = { FALSE, 0 };
+
+	if (_libusbControlMsgSubmit(device, direction, request, value, index, buffer, bufferSize, timeout, _libusbSyncCompletion, &syncRequest) != COMMON_NO_ERROR) {
+		return lastError;
+	}
+
+	pthread_mutex_lock(&eventMutex);
+
+	while (! syncRequest.done) {
+		pthread_cond_wait(&eventCond, &eventMutex);
+	}
+
+	pthread_mutex_unlock(&eventMutex);
+
+	if (syncRequest.result < 0) {
+		lastError = syncRequest.result;
+	}
+
+	return syncRequest.result;
+}
+
+
+static const char *_libusbStrerror(void) {
+	return libusb_strerror(lastError);
+}
+
+
+const Transport transportLibusb = {
+	.name             = "libusb",
+	.initialize       = _libusbInitialize,
+	.terminate        = _libusbTerminate,
+	.enumerate        = _libusbEnumerate,
+	.open             = _libusbOpen,
+	.close            = _libusbClose,
+	.controlMsg       = _libusbControlMsg,
+	.controlMsgSubmit = _libusbControlMsgSubmit,
+	.strerror         = _libusbStrerror
+};
@@ -0,0 +1,861 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bootloader/common/protocol.h"
+#include "burner/crc.h"
+#include "burner/transport.h"
+
+#define DEBUG_LEVEL 4
+#include "burner/common/debug.h"
+
+
+/*
+ * In-process jboot devices implementing bootloader protocol on ATmega328P
+ * memory model. Parameter is a comma separated list of state files, one
+ * device is created per file and its state is kept there between runs.
+ */
+
+#define SIMULATOR_DEVICES_MAX 16
+
+#define SIMULATOR_VERSION_MAJOR 0x00
+#define SIMULATOR_VERSION_MINOR 0x0f
+
+#define SIMULATOR_CAPABILITIES ( \
+	BOOTLOADER_COMMON_CAPABILITY_E2PROM_BLOCK | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_CRC | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_WRITE | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES_CRC | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_PAGES | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_ERASE_PAGES | \
+	BOOTLOADER_COMMON_CAPABILITY_E2PROM_QUEUE | \
+	BOOTLOADER_COMMON_CAPABILITY_FLASH_COMPARE | \
+	BOOTLOADER_COMMON_CAPABILITY_STATS \
+)
+
+#define SIMULATOR_SIGNATURE_0 0x1e
+#define SIMULATOR_SIGNATURE_1 0x95
+#define SIMULATOR_SIGNATURE_2 0x0f
+
+#define SIMULATOR_FLASH_SIZE              (32 * 1024)
+#define SIMULATOR_FLASH_PAGE_SIZE         128
+#define SIMULATOR_BOOT_SIZE_IN_PAGES      32
+#define SIMULATOR_APPLICATION_PAGES_COUNT (SIMULATOR_FLASH_SIZE / SIMULATOR_FLASH_PAGE_SIZE - SIMULATOR_BOOT_SIZE_IN_PAGES)
+#define SIMULATOR_E2PROM_SIZE             1024
+#define SIMULATOR_E2PROM_QUEUE_SIZE       64
+
+// Low speed USB timing: setup and status stages plus one transaction per
+// 8 byte data packet, one transaction per 1 ms frame.
+#define SIMULATOR_USB_TRANSACTION_US 1000
+#define SIMULATOR_USB_PACKET_SIZE    8
+
+// Device side timing (ATmega328P datasheet, 16 MHz clock)
+#define SIMULATOR_SPM_BUSY_US           4500
+#define SIMULATOR_E2PROM_WRITE_US       3400
+#define SIMULATOR_CRC8_NS_PER_BYTE      1000
+#define SIMULATOR_CRC16_NS_PER_BYTE     1000
+#define SIMULATOR_SPM_TIMER_FREQUENCY   250000 // 16 MHz / 64
+
+
+typedef struct _SimulatorFlashReport {
+	_U16 pagesWritten;
+	_U16 pagesUnchanged;
+	_U16 pagesErased;
+	_U16 erasesSkipped;
+} SimulatorFlashReport;
+
+
+typedef struct _SimulatorStats {
+	_U32 setupRequests;
+	_U32 bytesIn;
+	_U32 bytesOut;
+	_U16 pagesErased;
+	_U16 pagesWritten;
+	_U64 spmBusyTime; // us
+} SimulatorStats;
+
+
+struct _TransportDevice {
+	_U8   flash[SIMULATOR_FLASH_SIZE];
+	_U8   e2prom[SIMULATOR_E2PROM_SIZE];
+	_BOOL rebooted;
+	_U32  slot;
+	_U64  spmBusyUntil;    // Monotonic time in us when the last streamed page is programmed
+	_U64  e2promBusyUntil; // Monotonic time in us when e2prom write queue is drained
+
+	SimulatorFlashReport flashReport;
+	SimulatorStats       stats;
+};
+
+
+typedef struct _SimulatorSlot {
+	char  *statePath;
+	_BOOL  opened;
+} SimulatorSlot;
+
+
+static SimulatorSlot slots[SIMULATOR_DEVICES_MAX];
+
+static _U32 slotsCount = 0;
+
+static char *parameterCopy = NULL;
+
+static pthread_mutex_t slotsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread const char *lastError = "";
+
+
+static void _simulatorDelay(_U32 us) {
+	if (us > 0) {
+		usleep(us);
+	}
+}
+
+
+static _U64 _simulatorTime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (_U64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void _flashPageProgram(TransportDevice *device, _U32 pageNumber, _U8 *data, _BOOL erase) {
+	_U8 *page = device->flash + pageNumber * SIMULATOR_FLASH_PAGE_SIZE;
+	_U32 i;
+
+	if (erase) {
+		memset(page, 0xff, SIMULATOR_FLASH_PAGE_SIZE);
+	}
+
+	// Programming can only clear bits
+	for (i = 0; i < SIMULATOR_FLASH_PAGE_SIZE; i++) {
+		page[i] &= data[i];
+	}
+}
+
+
+static _BOOL _flashPageIsBlank(TransportDevice *device, _U32 pageNumber) {
+	_U8 *page = device->flash + pageNumber * SIMULATOR_FLASH_PAGE_SIZE;
+	_U32 i;
+
+	for (i = 0; i < SIMULATOR_FLASH_PAGE_SIZE; i++) {
+		if (page[i] != 0xff) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
+// Blank pages are not erased
+static void _flashPageErase(TransportDevice *device, _U32 pageNumber) {
+	if (_flashPageIsBlank(device, pageNumber)) {
+		device->flashReport.erasesSkipped++;
+
+		return;
+	}
+
+	memset(device->flash + pageNumber * SIMULATOR_FLASH_PAGE_SIZE, 0xff, SIMULATOR_FLASH_PAGE_SIZE);
+
+	device->flashReport.pagesErased++;
+	device->stats.pagesErased++;
+	device->stats.spmBusyTime += SIMULATOR_SPM_BUSY_US;
+
+	_simulatorDelay(SIMULATOR_SPM_BUSY_US);
+}
+
+
+/*
+ * Device receives the next page into staging buffer while the previous one is
+ * programmed, data is NAKed only if staging buffer is still full. Time of
+ * packets is accounted by caller, only stalls are waited here.
+ */
+static void _flashPagesStream(TransportDevice *device, _U32 firstPage, _U32 pagesCount, _U8 *data, _U8 flags) {
+	_U64 receiveTime = SIMULATOR_FLASH_PAGE_SIZE / SIMULATOR_USB_PACKET_SIZE * SIMULATOR_USB_TRANSACTION_US;
+	_U64 time        = _simulatorTime();
+	_U64 stall       = 0;
+	_U32 i;
+
+	for (i = 0; i < pagesCount; i++) {
+		_U8  *pageData    = data + i * SIMULATOR_FLASH_PAGE_SIZE;
+		_BOOL erase       = (flags & BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE) != 0;
+		_U64  programTime = 0;
+
+		time += receiveTime;
+
+		if (device->spmBusyUntil > time) {
+			stall += device->spmBusyUntil - time;
+			time   = device->spmBusyUntil;
+		}
+
+		if (
+			(flags & BOOTLOADER_COMMON_FLASH_WRITE_FLAG_COMPARE) &&
+			(memcmp(device->flash + (firstPage + i) * SIMULATOR_FLASH_PAGE_SIZE, pageData, SIMULATOR_FLASH_PAGE_SIZE) == 0)
+		) {
+			device->flashReport.pagesUnchanged++;
+			continue;
+		}
+
+		if (erase && _flashPageIsBlank(device, firstPage + i)) {
+			erase = FALSE;
+
+			device->flashReport.erasesSkipped++;
+		}
+
+		_flashPageProgram(device, firstPage + i, pageData, erase);
+
+		device->flashReport.pagesWritten++;
+		device->stats.pagesWritten++;
+
+		programTime = SIMULATOR_SPM_BUSY_US;
+
+		if (erase) {
+			device->flashReport.pagesErased++;
+			device->stats.pagesErased++;
+
+			programTime += SIMULATOR_SPM_BUSY_US;
+		}
+
+		device->stats.spmBusyTime += programTime;
+
+		device->spmBusyUntil = time + programTime;
+	}
+
+	_simulatorDelay(stall);
+}
+
+
+/*
+ * Bytes are written from queue one after another, host is NAKed only when
+ * the queue is full. Time of packets is accounted by caller.
+ */
+static void _e2promQueue(TransportDevice *device, _U32 address, _U8 *data, _U32 dataSize) {
+	_U64 receiveTime = SIMULATOR_USB_TRANSACTION_US / SIMULATOR_USB_PACKET_SIZE;
+	_U64 queueTime   = (SIMULATOR_E2PROM_QUEUE_SIZE - 1) * SIMULATOR_E2PROM_WRITE_US;
+	_U64 time        = _simulatorTime();
+	_U64 stall       = 0;
+	_U32 i;
+
+	for (i = 0; i < dataSize; i++) {
+		device->e2prom[(address + i) % SIMULATOR_E2PROM_SIZE] = data[i];
+
+		time += receiveTime;
+
+		// Byte is accepted when the oldest queued one is written
+		if (device->e2promBusyUntil > time + queueTime) {
+			stall += device->e2promBusyUntil - queueTime - time;
+			time   = device->e2promBusyUntil - queueTime;
+		}
+
+		device->e2promBusyUntil = ((device->e2promBusyUntil > time) ? device->e2promBusyUntil : time) + SIMULATOR_E2PROM_WRITE_US;
+	}
+
+	_simulatorDelay(stall);
+}
+
+
+static _U32 _e2promQueuePending(TransportDevice *device) {
+	_U64 time = _simulatorTime();
+
+	if (device->e2promBusyUntil <= time) {
+		return 0;
+	}
+
+	return (device->e2promBusyUntil - time + SIMULATOR_E2PROM_WRITE_US - 1) / SIMULATOR_E2PROM_WRITE_US;
+}
+
+
+static _U32 _putU16(_U8 *buffer, _U16 value) {
+	buffer[0] = value;
+	buffer[1] = value >> 8;
+
+	return 2;
+}
+
+
+static _U32 _putU32(_U8 *buffer, _U32 value) {
+	_putU16(buffer,     value);
+	_putU16(buffer + 2, value >> 16);
+
+	return 4;
+}
+
+
+// Commands other than flash writes wait for streamed pages, ones other than e2prom writes for queued bytes
+static void _waitIdle(TransportDevice *device, _U8 request, _U16 value) {
+	_U64 time = _simulatorTime();
+	_U64 until = 0;
+
+	if (
+		(request != BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE) &&
+		(request != BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE) &&
+		(request != BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES)
+	) {
+		until = device->spmBusyUntil;
+	}
+
+	if (
+		(request != BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE) &&
+		(request != BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK) &&
+		! ((request == BOOTLOADER_COMMON_COMMAND_E2PROM_SYNC) && ! (value & BOOTLOADER_COMMON_E2PROM_SYNC_FLAG_WAIT))
+	) {
+		if (device->e2promBusyUntil > until) {
+			until = device->e2promBusyUntil;
+		}
+	}
+
+	if (until > time) {
+		_simulatorDelay(until - time);
+	}
+}
+
+
+static _S32 _handleIn(TransportDevice *device, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize) {
+	_U8  response[BOOTLOADER_COMMON_STATS_RESPONSE_SIZE];
+	_S32 responseSize = 0;
+
+	switch (request) {
+		case BOOTLOADER_COMMON_COMMAND_CONNECT:
+			memset(&device->flashReport, 0, sizeof(device->flashReport));
+
+			response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_GET_INFO:
+		case BOOTLOADER_COMMON_COMMAND_HELLO:
+			response[0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			response[1] = SIMULATOR_VERSION_MAJOR;
+			response[2] = SIMULATOR_VERSION_MINOR;
+			response[3] = SIMULATOR_BOOT_SIZE_IN_PAGES;
+			response[4] = SIMULATOR_SIGNATURE_0;
+			response[5] = SIMULATOR_SIGNATURE_1;
+			response[6] = SIMULATOR_SIGNATURE_2;
+
+			responseSize = 7;
+
+			if (request == BOOTLOADER_COMMON_COMMAND_HELLO) {
+				memset(&device->flashReport, 0, sizeof(device->flashReport));
+
+				response[7] = SIMULATOR_CAPABILITIES & 0xff;
+				response[8] = SIMULATOR_CAPABILITIES >> 8;
+
+				responseSize = BOOTLOADER_COMMON_HELLO_RESPONSE_SIZE;
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE:
+		case BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGES:
+			{
+				_U32 size = bufferSize;
+
+				if (request == BOOTLOADER_COMMON_COMMAND_FLASH_READ_PAGE) {
+					if (size > SIMULATOR_FLASH_PAGE_SIZE) {
+						size = SIMULATOR_FLASH_PAGE_SIZE;
+					}
+
+					if (index >= SIMULATOR_APPLICATION_PAGES_COUNT) {
+						response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+						break;
+					}
+
+				} else if (
+					(bufferSize % SIMULATOR_FLASH_PAGE_SIZE != 0) ||
+					(index + bufferSize / SIMULATOR_FLASH_PAGE_SIZE > SIMULATOR_APPLICATION_PAGES_COUNT)
+				) {
+					response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+					break;
+				}
+
+				memcpy(buffer, device->flash + index * SIMULATOR_FLASH_PAGE_SIZE, size);
+
+				return size;
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGE:
+			if (index >= SIMULATOR_APPLICATION_PAGES_COUNT) {
+				response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+				break;
+			}
+
+			_flashPageErase(device, index);
+
+			response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_PAGES:
+			if (index + value > SIMULATOR_APPLICATION_PAGES_COUNT) {
+				response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+				break;
+			}
+
+			{
+				_U32 i;
+
+				for (i = 0; i < value; i++) {
+					_flashPageErase(device, index + i);
+				}
+			}
+
+			response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_REPORT:
+			{
+				SimulatorFlashReport *report = &device->flashReport;
+
+				response[0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+				response[1] = report->pagesWritten & 0xff;
+				response[2] = report->pagesWritten >> 8;
+				response[3] = report->pagesUnchanged & 0xff;
+				response[4] = report->pagesUnchanged >> 8;
+				response[5] = report->pagesErased & 0xff;
+				response[6] = report->pagesErased >> 8;
+				response[7] = report->erasesSkipped & 0xff;
+				response[8] = report->erasesSkipped >> 8;
+
+				responseSize = BOOTLOADER_COMMON_FLASH_REPORT_RESPONSE_SIZE;
+
+				memset(report, 0, sizeof(*report));
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_E2PROM_READ:
+			response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			response[responseSize++] = device->e2prom[index % SIMULATOR_E2PROM_SIZE];
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE:
+			{
+				_U8 byte = value;
+
+				_e2promQueue(device, index, &byte, 1);
+			}
+
+			response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_E2PROM_SYNC:
+			{
+				_U32 pending = _e2promQueuePending(device);
+
+				response[0] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+				response[1] = pending;
+				response[2] = pending >> 8;
+
+				responseSize = 3;
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_E2PROM_READ_BLOCK:
+			if (index + bufferSize > SIMULATOR_E2PROM_SIZE) {
+				response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+				break;
+			}
+
+			memcpy(buffer, device->e2prom + index, bufferSize);
+
+			return bufferSize;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_CRC:
+			{
+				_U32 pagesCount = value & 0xff;
+
+				if (index + pagesCount > SIMULATOR_APPLICATION_PAGES_COUNT) {
+					response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+					break;
+				}
+
+				response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+				response[responseSize++] = crc8_get(device->flash + index * SIMULATOR_FLASH_PAGE_SIZE, pagesCount * SIMULATOR_FLASH_PAGE_SIZE, value >> 8);
+
+				_simulatorDelay(pagesCount * SIMULATOR_FLASH_PAGE_SIZE * SIMULATOR_CRC8_NS_PER_BYTE / 1000);
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_PAGES_CRC:
+			{
+				_U32 pagesCount = bufferSize / 2;
+				_U32 i;
+
+				if ((bufferSize & 0x01) || (index + pagesCount > SIMULATOR_APPLICATION_PAGES_COUNT)) {
+					response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_ERROR;
+					break;
+				}
+
+				for (i = 0; i < pagesCount; i++) {
+					_U16 pageCrc = crc16_get(device->flash + (index + i) * SIMULATOR_FLASH_PAGE_SIZE, SIMULATOR_FLASH_PAGE_SIZE, PAGE_CHECKSUM_INITIAL);
+
+					buffer[2 * i + 0] = pageCrc & 0xff;
+					buffer[2 * i + 1] = pageCrc >> 8;
+				}
+
+				_simulatorDelay(pagesCount * SIMULATOR_FLASH_PAGE_SIZE * SIMULATOR_CRC16_NS_PER_BYTE / 1000);
+
+				return bufferSize;
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_GET_STATS:
+			{
+				SimulatorStats *stats    = &device->stats;
+				_U32            spmTicks = stats->spmBusyTime * SIMULATOR_SPM_TIMER_FREQUENCY / 1000000;
+
+				response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+
+				responseSize += _putU32(response + responseSize, stats->setupRequests);
+				responseSize += _putU32(response + responseSize, stats->bytesIn);
+				responseSize += _putU32(response + responseSize, stats->bytesOut);
+				responseSize += _putU16(response + responseSize, stats->pagesErased);
+				responseSize += _putU16(response + responseSize, stats->pagesWritten);
+				responseSize += _putU32(response + responseSize, spmTicks);
+				responseSize += _putU32(response + responseSize, SIMULATOR_SPM_TIMER_FREQUENCY);
+
+				// Simulated device is never reset by watchdog and does not check image at boot
+				responseSize += _putU16(response + responseSize, 0);
+				responseSize += _putU16(response + responseSize, 0);
+
+				if (value & BOOTLOADER_COMMON_STATS_FLAG_CLEAR) {
+					memset(stats, 0, sizeof(*stats));
+				}
+			}
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_REBOOT:
+			device->rebooted = TRUE;
+
+			response[responseSize++] = BOOTLOADER_COMMON_COMMAND_STATUS_OK;
+			break;
+
+		default:
+			break;
+	}
+
+	if (responseSize > bufferSize) {
+		responseSize = bufferSize;
+	}
+
+	memcpy(buffer, response, responseSize);
+
+	return responseSize;
+}
+
+
+static _S32 _handleOut(TransportDevice *device, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize) {
+	_S32 ret = bufferSize;
+
+	switch (request) {
+		case BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGE:
+		case BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE:
+			if ((index >= SIMULATOR_APPLICATION_PAGES_COUNT) || (bufferSize != SIMULATOR_FLASH_PAGE_SIZE)) {
+				ret = -1;
+				break;
+			}
+
+			_flashPagesStream(device, index, 1, buffer, (request == BOOTLOADER_COMMON_COMMAND_FLASH_ERASE_WRITE_PAGE) ? BOOTLOADER_COMMON_FLASH_WRITE_FLAG_ERASE : 0);
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_FLASH_WRITE_PAGES:
+			if (
+				(bufferSize % SIMULATOR_FLASH_PAGE_SIZE != 0) ||
+				(index + bufferSize / SIMULATOR_FLASH_PAGE_SIZE > SIMULATOR_APPLICATION_PAGES_COUNT)
+			) {
+				ret = -1;
+				break;
+			}
+
+			_flashPagesStream(device, index, bufferSize / SIMULATOR_FLASH_PAGE_SIZE, buffer, value);
+			break;
+
+		case BOOTLOADER_COMMON_COMMAND_E2PROM_WRITE_BLOCK:
+			if (index + bufferSize > SIMULATOR_E2PROM_SIZE) {
+				ret = -1;
+				break;
+			}
+
+			_e2promQueue(device, index, buffer, bufferSize);
+			break;
+
+		default:
+			// Data of unknown requests is ignored by V-USB
+			break;
+	}
+
+	return ret;
+}
+
+
+static void _simulatorGetDeviceId(_U32 slot, TransportDeviceId *id) {
+	snprintf(id->name, sizeof(id->name), "000:%03d", slot + 1);
+}
+
+
+static CommonError _simulatorInitialize(const char *parameter) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	do {
+		char *path;
+		char *savePtr = NULL;
+
+		memset(slots, 0, sizeof(slots));
+
+		slotsCount = 0;
+
+		// Single device without state file
+		if ((parameter == NULL) || (*parameter == '\0')) {
+			slotsCount = 1;
+
+			break;
+		}
+
+		parameterCopy = strdup(parameter);
+		if (parameterCopy == NULL) {
+			ERR(("_simulatorInitialize(): No more free memory!"));
+
+			ret = COMMON_ERROR_NO_FREE_RESOURCES;
+			break;
+		}
+
+		for (path = strtok_r(parameterCopy, ",", &savePtr); path != NULL; path = strtok_r(NULL, ",", &savePtr)) {
+			if (slotsCount == SIMULATOR_DEVICES_MAX) {
+				REPORT_ERR(("Simulator supports up to %d devices!", SIMULATOR_DEVICES_MAX));
+
+				ret = COMMON_ERROR_BAD_PARAMETER;
+				break;
+			}
+
+			slots[slotsCount++].statePath = path;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+static CommonError _simulatorTerminate(void) {
+	if (parameterCopy != NULL) {
+		free(parameterCopy);
+
+		parameterCopy = NULL;
+	}
+
+	slotsCount = 0;
+
+	return COMMON_NO_ERROR;
+}
+
+
+static CommonError _simulatorEnumerate(TransportDeviceId *ids, _U32 idsMax, _U32 *idsCount) {
+	_U32 i;
+
+	*idsCount = 0;
+
+	for (i = 0; (i < slotsCount) && (i < idsMax); i++) {
+		_simulatorGetDeviceId(i, &ids[(*idsCount)++]);
+	}
+
+	return COMMON_NO_ERROR;
+}
+
+
+static CommonError _simulatorOpen(TransportDevice **device, const char *id, _U32 timeout) {
+	CommonError ret = COMMON_NO_ERROR;
+
+	{
+		_S32 slot = -1;
+
+		*device = NULL;
+
+		pthread_mutex_lock(&slotsMutex);
+
+		do {
+			const char *statePath;
+			_U32        i;
+
+			for (i = 0; i < slotsCount; i++) {
+				TransportDeviceId slotId;
+
+				_simulatorGetDeviceId(i, &slotId);
+
+				if (slots[i].opened) {
+					continue;
+				}
+
+				if ((id == NULL) || (strcmp(id, slotId.name) == 0)) {
+					slot = i;
+					break;
+				}
+			}
+
+			if (slot < 0) {
+				ret = COMMON_ERROR_NO_DEVICE;
+				break;
+			}
+
+			statePath = slots[slot].statePath;
+
+			*device = calloc(1, sizeof(TransportDevice));
+			if (*device == NULL) {
+				ERR(("_simulatorOpen(): No more free memory!"));
+
+				ret = COMMON_ERROR_NO_FREE_RESOURCES;
+				break;
+			}
+
+			memset((*device)->flash,  0xff, sizeof((*device)->flash));
+			memset((*device)->e2prom, 0xff, sizeof((*device)->e2prom));
+
+			(*device)->rebooted = FALSE;
+			(*device)->slot     = slot;
+
+			if (statePath != NULL) {
+				_S32 file = open(statePath, O_RDONLY);
+
+				if (file >= 0) {
+					if (
+						(read(file, (*device)->flash,  sizeof((*device)->flash))  != sizeof((*device)->flash)) ||
+						(read(file, (*device)->e2prom, sizeof((*device)->e2prom)) != sizeof((*device)->e2prom))
+					) {
+						REPORT_ERR(("Simulator state file '%s' is corrupted!", statePath));
+
+						ret = COMMON_ERROR;
+					}
+
+					close(file);
+				}
+			}
+
+			if (ret != COMMON_NO_ERROR) {
+				free(*device);
+
+				*device = NULL;
+				break;
+			}
+
+			slots[slot].opened = TRUE;
+		} while (0);
+
+		pthread_mutex_unlock(&slotsMutex);
+
+		if (ret == COMMON_NO_ERROR) {
+			// Enumeration and string descriptors
+			_simulatorDelay(3 * SIMULATOR_USB_TRANSACTION_US);
+		}
+	}
+
+	return ret;
+}
+
+
+static void _simulatorClose(TransportDevice *device) {
+	const char *statePath = slots[device->slot].statePath;
+
+	if (statePath != NULL) {
+		_S32 file = open(statePath, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+
+		if (file >= 0) {
+			if (
+				(write(file, device->flash,  sizeof(device->flash))  != sizeof(device->flash)) ||
+				(write(file, device->e2prom, sizeof(device->e2prom)) != sizeof(device->e2prom))
+			) {
+				REPORT_ERR(("Unable to save simulator state! (%m)"));
+			}
+
+			close(file);
+
+		} else {
+			REPORT_ERR(("Unable to open simulator state file! (%m)"));
+		}
+	}
+
+	pthread_mutex_lock(&slotsMutex);
+	{
+		slots[device->slot].opened = FALSE;
+	}
+	pthread_mutex_unlock(&slotsMutex);
+
+	free(device);
+}
+
+
+static _S32 _simulatorControlMsg(TransportDevice *device, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout) {
+	_S32 ret;
+	_U64 startTime = _simulatorTime();
+
+	do {
+		if (device->rebooted) {
+			lastError = "No such device (it may have been disconnected)";
+
+			ret = -1;
+			break;
+		}
+
+		_waitIdle(device, request, value);
+
+		device->stats.setupRequests++;
+
+		if (direction == TRANSPORT_DIRECTION_IN) {
+			ret = _handleIn(device, request, value, index, buffer, bufferSize);
+
+		} else {
+			ret = _handleOut(device, request, value, index, buffer, bufferSize);
+		}
+
+		if (ret < 0) {
+			lastError = "Broken pipe";
+
+			break;
+		}
+
+		if (direction == TRANSPORT_DIRECTION_IN) {
+			device->stats.bytesOut += ret;
+
+		} else {
+			device->stats.bytesIn += ret;
+		}
+
+		_simulatorDelay((2 + (ret + SIMULATOR_USB_PACKET_SIZE - 1) / SIMULATOR_USB_PACKET_SIZE) * SIMULATOR_USB_TRANSACTION_US);
+
+		// Request is done by device anyway, only host gives up as libusb does
+		if ((timeout != TRANSPORT_TIMEOUT_INFINITY) && (_simulatorTime() - startTime > (_U64) timeout * 1000)) {
+			lastError = "Operation timed out";
+
+			ret = -1;
+			break;
+		}
+	} while (0);
+
+	return ret;
+}
+
+
+// Simulated transfers take place immediately, completion is called before return
+static CommonError _simulatorControlMsgSubmit(TransportDevice *device, TransportDirection direction, _U8 request, _U16 value, _U16 index, _U8 *buffer, _U16 bufferSize, _U32 timeout, TransportCompletion completion, void *context) {
+	completion(_simulatorControlMsg(device, direction, request, value, index, buffer, bufferSize, timeout), context);
+
+	return COMMON_NO_ERROR;
+}
+
+
+static const char *_simulatorStrerror(void) {
+	return lastError;
+}
+
+
+const Transport transportSimulator = {
+	.name             = "simulator",
+	.initialize       = _simulatorInitialize,
+	.terminate        = _simulatorTerminate,
+	.enumerate        = _simulatorEnumerate,
+	.open             = _simulatorOpen,
+	.close            = _simulatorClose,
+	.controlMsg       = _simulatorControlMsg,
+	.controlMsgSubmit = _simulatorControlMsgSubmit,
+	.strerror         = _simulatorStrerror
+};